@@ -19,10 +19,10 @@
  * 		Tomaz Solc, <tomaz.solc@ijs.si> */
 #include <stdio.h>
 #include <stdlib.h>
+#include <libopencm3/stm32/exti.h>
 #include <libopencm3/stm32/f1/gpio.h>
+#include <libopencm3/stm32/nvic.h>
 #include <libopencm3/stm32/f1/rcc.h>
-#include <libopencm3/stm32/f1/rtc.h>
-#include <libopencm3/stm32/iwdg.h>
 #include <libopencm3/stm32/spi.h>
 #include <libopencm3/stm32/systick.h>
 
@@ -70,6 +70,21 @@ static void setup_stm32f1_peripherals(void)
 	systick_set_reload(0x00ffffff);
 	systick_set_clocksource(STK_CTRL_CLKSOURCE_AHB_DIV8);
 	systick_counter_enable();
+
+#ifdef CC_PIN_GDO2
+	rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_AFIOEN);
+
+	gpio_set_mode(CC_GPIO_GDO2, GPIO_MODE_INPUT,
+			GPIO_CNF_INPUT_FLOAT, CC_PIN_GDO2);
+	gpio_set_mode(CC_GPIO_GDO0, GPIO_MODE_INPUT,
+			GPIO_CNF_INPUT_FLOAT, CC_PIN_GDO0);
+
+	exti_select_source(CC_EXTI_GDO2, CC_GPIO_GDO2);
+	exti_set_trigger(CC_EXTI_GDO2, EXTI_TRIGGER_BOTH);
+	exti_enable_request(CC_EXTI_GDO2);
+
+	nvic_enable_irq(CC_NVIC_GDO2);
+#endif
 }
 
 static void cc_wait_while_miso_high(void)
@@ -77,15 +92,6 @@ static void cc_wait_while_miso_high(void)
 	while(gpio_get(CC_GPIO_SPI, CC_PIN_MISO));
 }
 
-static const uint32_t systick_udelay_calibration = 6;
-
-static void systick_udelay(uint32_t usecs)
-{
-	uint32_t val = (STK_VAL - systick_udelay_calibration * usecs) 
-		& 0x00ffffff;
-	while(!((STK_VAL - val) & 0x00800000));
-}
-
 static void cc_reset() 
 {
 	gpio_clear(CC_GPIO_NSS, CC_PIN_NSS);
@@ -147,10 +153,168 @@ void cc_wait_state(uint8_t state)
 	while(cc_read_reg(CC_REG_MARCSTATE) != state);
 }
 
+#ifdef CC_PIN_GDO2
+/* GDO2 is configured to go high when the receiver is running (inverted
+ * LNA_PD signal). The interrupt only serves to wake the CPU from WFI in
+ * cc_wait_gdo2(). */
+void CC_ISR_GDO2(void)
+{
+	exti_reset_request(CC_EXTI_GDO2);
+}
+
+/* Set to 1 if reset found GDO2 actually connected to CC_PIN_GDO2. */
+static int cc_gdo2_ok = 0;
+
+static int cc_get_gdo2(void)
+{
+	return gpio_get(CC_GPIO_GDO2, CC_PIN_GDO2) ? 1 : 0;
+}
+
+/* Sleep until GDO2 pin is at the given level.
+ *
+ * Interrupts are masked while checking the pin, so that an edge between
+ * the check and WFI still wakes us up (pending interrupt terminates WFI
+ * even when masked with PRIMASK). */
+static void cc_wait_gdo2(int level)
+{
+	__asm__("cpsid i");
+	while(cc_get_gdo2() != level) {
+		__asm__("wfi");
+		__asm__("cpsie i");
+		__asm__("cpsid i");
+	}
+	__asm__("cpsie i");
+}
+
+/* Check that GDO2 can be driven both ways by the radio. Boards that don't
+ * have it connected fall back to polling MARCSTATE over SPI. */
+static int cc_check_gdo2(void)
+{
+	cc_write_reg(CC_REG_IOCFG2, CC_IOCFG_HW_TO_0|CC_IOCFG_INV);
+	systick_udelay(10);
+	if(!cc_get_gdo2()) return 0;
+
+	cc_write_reg(CC_REG_IOCFG2, CC_IOCFG_HW_TO_0);
+	systick_udelay(10);
+	if(cc_get_gdo2()) return 0;
+
+	return 1;
+}
+#endif
+
+/* Wait for the radio to enter RX after a SRX strobe. */
+static void cc_wait_rx(void)
+{
+#ifdef CC_PIN_GDO2
+	if(cc_gdo2_ok) {
+		cc_wait_gdo2(1);
+		return;
+	}
+#endif
+	cc_wait_state(CC_MARCSTATE_RX);
+}
+
+/* Wait for the radio to enter IDLE after a SIDLE strobe. */
+static void cc_wait_idle(void)
+{
+#ifdef CC_PIN_GDO2
+	/* LNA is powered down slightly before the state machine settles in
+	 * IDLE, so sleep until then and confirm with a single read. */
+	if(cc_gdo2_ok) {
+		cc_wait_gdo2(0);
+	}
+#endif
+	cc_wait_state(CC_MARCSTATE_IDLE);
+}
+
+/* FIXME: calculate value according to the formula in the datasheet */
+static const uint32_t cc_rssi_delay_us = 5000;
+
+/* SysTick value when the receiver entered RX in the last cc_tune() */
+static uint32_t cc_rx_start;
+
+/* Tune to channel ch. Use cc_wait_rx_time() to wait for RSSI to become
+ * valid. */
+static void cc_tune(int ch)
+{
+	cc_strobe(CC_STROBE_SIDLE);
+	cc_wait_idle();
+
+	cc_write_reg(CC_REG_CHANNR, ch);
+
+	cc_strobe(CC_STROBE_SRX);
+	cc_wait_rx();
+
+	cc_rx_start = STK_VAL;
+}
+
+/* Wait until the receiver has been in RX for at least usecs. If more than
+ * one SysTick period (approx. 2.8 s) passed since cc_tune(), this might 
+ * wait needlessly, but never too short. */
+static void cc_wait_rx_time(uint32_t usecs)
+{
+	uint32_t ticks = SYSTICK_TICKS_PER_US * usecs;
+	while(((cc_rx_start - STK_VAL) & 0x00ffffff) < ticks);
+}
+
+/* Crystal oscillator frequency on all CC boards */
+#define CC_XOSC_HZ		26000000
+
+/* Number of RSSI updates to wait for before reading carrier sense */
+#define CC_CS_RSSI_UPDATES	4
+
+/* Time to wait for carrier sense after entering RX for the current
+ * configuration. Set by dev_cc_setup(). */
+static uint32_t cc_cs_delay_us = 0;
+
+/* Return the carrier sense response time for the configuration in init_seq.
+ *
+ * Carrier sense is asserted from RSSI, which is updated at (datasheet, section
+ * on RSSI):
+ *
+ * f_RSSI = 2 BW_channel / (8 2^FILTER_LENGTH)
+ *
+ * BW_channel = f_XOSC / (8 (4 + CHANBW_M) 2^CHANBW_E)
+ *
+ * so narrow RX filters take considerably longer than wide ones. */
+static uint32_t cc_get_cs_delay_us(const uint8_t* init_seq)
+{
+	uint8_t mdmcfg4 = 0, agcctrl0 = 0;
+
+	int n;
+	for(n = 0; init_seq[n] != 0xff; n += 2) {
+		if(init_seq[n] == CC_REG_MDMCFG4) mdmcfg4 = init_seq[n+1];
+		if(init_seq[n] == CC_REG_AGCCTRL0) agcctrl0 = init_seq[n+1];
+	}
+
+	int chanbw_e = (mdmcfg4 >> 6) & 0x3;
+	int chanbw_m = (mdmcfg4 >> 4) & 0x3;
+	int filter_length = agcctrl0 & 0x3;
+
+	/* 1/f_RSSI = 32 (4 + CHANBW_M) 2^(CHANBW_E + FILTER_LENGTH) / f_XOSC */
+	uint64_t t = (uint64_t) CC_CS_RSSI_UPDATES * 32 * (4 + chanbw_m) *
+		(1 << (chanbw_e + filter_length)) * 1000000;
+
+	return (t + CC_XOSC_HZ - 1) / CC_XOSC_HZ;
+}
+
+/* Return current RSSI in 0.01 dBm */
+static int cc_get_rssi_dbm_100(void)
+{
+	int8_t reg = cc_read_reg(CC_REG_RSSI);
+
+	return -5920 + ((int) reg) * 50;
+}
+
 int dev_cc_reset(void* priv __attribute__((unused))) 
 {
 	setup_stm32f1_peripherals();
 	cc_reset();
+#ifdef CC_PIN_GDO2
+	cc_wait_state(CC_MARCSTATE_IDLE);
+	cc_gdo2_ok = cc_check_gdo2();
+	cc_write_reg(CC_REG_IOCFG2, CC_IOCFG_LNA_PD|CC_IOCFG_INV);
+#endif
 	return E_SPECTRUM_OK;
 }
 
@@ -160,7 +324,7 @@ int dev_cc_setup(void* priv __attribute__((unused)),
 	uint8_t *init_seq = (uint8_t*) sweep_config->dev_config->priv;
 
 	cc_strobe(CC_STROBE_SIDLE);
-	cc_wait_state(CC_MARCSTATE_IDLE);
+	cc_wait_idle();
 
 	int n;
 	for(n = 0; init_seq[n] != 0xff; n += 2) {
@@ -169,66 +333,105 @@ int dev_cc_setup(void* priv __attribute__((unused)),
 		cc_write_reg(reg, value);
 	}
 
+	cc_cs_delay_us = cc_get_cs_delay_us(init_seq);
+
+#ifdef CC_GDO_IRQ
+	/* GDO pins are only driven on boards where their wiring is known */
+	cc_write_reg(CC_REG_IOCFG2, CC_IOCFG_LNA_PD|CC_IOCFG_INV);
+	cc_write_reg(CC_REG_IOCFG0, CC_IOCFG_CARRIER_SENSE);
+#endif
+
+	return E_SPECTRUM_OK;
+}
+
+int dev_cc_tune(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		int channel)
+{
+	cc_tune(channel);
+	return E_SPECTRUM_OK;
+}
+
+int dev_cc_read_measure(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		short int* data)
+{
+	cc_wait_rx_time(cc_rssi_delay_us);
+	*data = cc_get_rssi_dbm_100();
 	return E_SPECTRUM_OK;
 }
 
-int dev_cc_run(void* priv __attribute__((unused)),
-		const struct spectrum_sweep_config* sweep_config)
+int dev_cc_standby(void* priv __attribute__((unused)))
 {
-	int r;
-	short int *data;
-	/* FIXME: calculate value according to the formula in the datasheet */
-	const uint32_t rssi_delay_us = 5000;
+	cc_strobe(CC_STROBE_SIDLE);
+	cc_wait_idle();
+	return E_SPECTRUM_OK;
+}
 
-	rtc_set_counter_val(0);
+/* AGCCTRL1 value applied by dev_cc_setup, restored after an occupancy scan */
+static uint8_t cc_agcctrl1_saved;
 
-	int channel_num = spectrum_sweep_channel_num(sweep_config);
-	data = calloc(channel_num, sizeof(*data));
-	if (data == NULL) {
-		return E_SPECTRUM_TOOMANY;
+int dev_cc_occupancy_start(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		const struct spectrum_occupancy_config* occupancy_config)
+{
+	if (occupancy_config->threshold < -7 || occupancy_config->threshold > 7) {
+		return E_SPECTRUM_INVALID;
 	}
 
-	do {
-		IWDG_KR = IWDG_KR_RESET;
-		uint32_t rtc_counter = rtc_get_counter_val();
-		/* LSE clock is 32768 Hz. Prescaler is set to 16.
-		 *
-		 *                 rtc_counter * 16
-		 * t [ms] = 1000 * ----------------
-		 *                       32768
-		 */
-		int timestamp = ((long long) rtc_counter) * 1000 / 2048;
+	/* Threshold is relative to the AGC target amplitude (MAGN_TARGET). 
+	 * Relative carrier sense is disabled. */
+	cc_agcctrl1_saved = cc_read_reg(CC_REG_AGCCTRL1);
+	uint8_t agcctrl1 = cc_agcctrl1_saved;
+	agcctrl1 &= ~(CC_REG_AGCCTRL1_CS_ABS_THR_BM|CC_REG_AGCCTRL1_CS_REL_THR_BM);
+	agcctrl1 |= occupancy_config->threshold & CC_REG_AGCCTRL1_CS_ABS_THR_BM;
+	cc_write_reg(CC_REG_AGCCTRL1, agcctrl1);
 
-		int n, ch;
-		for(		ch = sweep_config->channel_start, n = 0; 
-				ch < sweep_config->channel_stop && n < channel_num; 
-				ch += sweep_config->channel_step, n++) {
+	return E_SPECTRUM_OK;
+}
 
-			cc_strobe(CC_STROBE_SIDLE);
-			cc_wait_state(CC_MARCSTATE_IDLE);
+int dev_cc_read_occupancy(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		int* busy)
+{
+	cc_wait_rx_time(cc_cs_delay_us);
 
-			cc_write_reg(CC_REG_CHANNR, ch);
+	*busy = (cc_read_reg(CC_REG_PKTSTATUS) & CC_REG_PKTSTATUS_CS) ? 1 : 0;
 
-			cc_strobe(CC_STROBE_SRX);
-			cc_wait_state(CC_MARCSTATE_RX);
+	return E_SPECTRUM_OK;
+}
 
-			systick_udelay(rssi_delay_us);
+int dev_cc_occupancy_stop(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)))
+{
+	/* Settings applied by dev_cc_setup are reused by following scans */
+	cc_write_reg(CC_REG_AGCCTRL1, cc_agcctrl1_saved);
 
-			int8_t reg = cc_read_reg(CC_REG_RSSI);
+	return E_SPECTRUM_OK;
+}
 
-			int rssi_dbm_100 = -5920 + ((int) reg) * 50;
-			data[n] = rssi_dbm_100;
-		}
-		r = sweep_config->cb(sweep_config, timestamp, data);
-	} while(!r);
+int dev_cc_zero_span_start(void* priv __attribute__((unused)),
+		const struct spectrum_zero_span_config* zero_span_config)
+{
+	cc_tune(zero_span_config->channel);
+	cc_wait_rx_time(cc_rssi_delay_us);
+	return E_SPECTRUM_OK;
+}
 
-	free(data);
+int dev_cc_zero_span_sample(void* priv __attribute__((unused)),
+		const struct spectrum_zero_span_config* zero_span_config __attribute__((unused)),
+		short int* data)
+{
+	*data = cc_get_rssi_dbm_100();
+	return E_SPECTRUM_OK;
+}
 
-	if (r == E_SPECTRUM_STOP_SWEEP) {
-		return E_SPECTRUM_OK;
-	} else {
-		return r;
-	}
+int dev_cc_zero_span_stop(void* priv __attribute__((unused)),
+		const struct spectrum_zero_span_config* zero_span_config __attribute__((unused)))
+{
+	cc_strobe(CC_STROBE_SIDLE);
+	cc_wait_idle();
+	return E_SPECTRUM_OK;
 }
 
 static void dev_cc_print_status(void)
@@ -924,7 +1127,16 @@ const struct spectrum_dev dev_cc1101 = {
 
 	.dev_reset		= dev_cc_reset,
 	.dev_setup		= dev_cc_setup,
-	.dev_run		= dev_cc_run,
+	.dev_tune		= dev_cc_tune,
+	.dev_read_measure	= dev_cc_read_measure,
+	.dev_standby		= dev_cc_standby,
+
+	.dev_occupancy_start	= dev_cc_occupancy_start,
+	.dev_read_occupancy	= dev_cc_read_occupancy,
+	.dev_occupancy_stop	= dev_cc_occupancy_stop,
+	.dev_zero_span_start	= dev_cc_zero_span_start,
+	.dev_zero_span_sample	= dev_cc_zero_span_sample,
+	.dev_zero_span_stop	= dev_cc_zero_span_stop,
 
 	.priv 			= NULL
 };
@@ -1098,7 +1310,16 @@ const struct spectrum_dev dev_cc2500 = {
 
 	.dev_reset		= dev_cc_reset,
 	.dev_setup		= dev_cc_setup,
-	.dev_run		= dev_cc_run,
+	.dev_tune		= dev_cc_tune,
+	.dev_read_measure	= dev_cc_read_measure,
+	.dev_standby		= dev_cc_standby,
+
+	.dev_occupancy_start	= dev_cc_occupancy_start,
+	.dev_read_occupancy	= dev_cc_read_occupancy,
+	.dev_occupancy_stop	= dev_cc_occupancy_stop,
+	.dev_zero_span_start	= dev_cc_zero_span_start,
+	.dev_zero_span_sample	= dev_cc_zero_span_sample,
+	.dev_zero_span_stop	= dev_cc_zero_span_stop,
 
 	.priv 			= NULL
 };
@@ -35,6 +35,19 @@
 
 #	define CC_SPI		SPI2
 
+/* GDO wiring has not been confirmed against the board schematic. PB10 and
+ * PB11 are also USART3 and I2C2 pins, hence the GDO path is opt-in. */
+#	ifdef CC_GDO_IRQ
+#		define CC_GPIO_GDO0	GPIOB
+#		define CC_PIN_GDO0	GPIO11
+
+#		define CC_GPIO_GDO2	GPIOB
+#		define CC_PIN_GDO2	GPIO10
+#		define CC_EXTI_GDO2	EXTI10
+#		define CC_NVIC_GDO2	NVIC_EXTI15_10_IRQ
+#		define CC_ISR_GDO2	exti15_10_isr
+#	endif
+
 #endif
 
 #if defined(MODEL_SNE_ISMTV_868) || defined(MODEL_SNE_ISMTV_2400)
@@ -49,6 +62,19 @@
 
 #	define CC_SPI		SPI1
 
+/* GDO wiring has not been confirmed against the board schematic, hence the
+ * GDO path is opt-in. */
+#	ifdef CC_GDO_IRQ
+#		define CC_GPIO_GDO0	GPIOB
+#		define CC_PIN_GDO0	GPIO6
+
+#		define CC_GPIO_GDO2	GPIOB
+#		define CC_PIN_GDO2	GPIO5
+#		define CC_EXTI_GDO2	EXTI5
+#		define CC_NVIC_GDO2	NVIC_EXTI9_5_IRQ
+#		define CC_ISR_GDO2	exti9_5_isr
+#	endif
+
 #endif
 
 /* Configuration Registers */
@@ -193,10 +219,19 @@
 #define CC_MARCSTATE_RXTX_SWITCH             0x15
 #define CC_MARCSTATE_TXFIFO_UNDERFLOW        0x16
 
+/* GDOx output pin configuration (IOCFGx register values) */
+#define CC_IOCFG_CARRIER_SENSE                 0x0E
+#define CC_IOCFG_LNA_PD                        0x1C
+#define CC_IOCFG_HW_TO_0                       0x2F
+#define CC_IOCFG_INV                           0x40
+
 /* Other register bit fields */
 #define CC_REG_LQI_CRC_OK_BM                   0x80
 #define CC_REG_LQI_EST_BM                      0x7F
 #define CC_REG_PKTSTATUS_SFD		       0x08
+#define CC_REG_PKTSTATUS_CS		       0x40
+#define CC_REG_AGCCTRL1_CS_ABS_THR_BM          0x0F
+#define CC_REG_AGCCTRL1_CS_REL_THR_BM          0x30
 
 int dev_cc_register(void);
 void dev_cc1101_print_status(void);
@@ -16,12 +16,168 @@
 
 /* Author: Tomaz Solc, <tomaz.solc@ijs.si> */
 #include <stdlib.h>
-#include <libopencm3/stm32/f1/rtc.h>
+#include <libopencm3/stm32/systick.h>
 
 #include "spectrum.h"
 
+/* Synthetic signal in a dummy scenario. */
+struct dev_dummy_signal {
+	/* First channel and number of channels occupied by the signal */
+	int channel;
+	int width;
+
+	/* Received power in 0.01 dBm */
+	short int power;
+
+	/* Signal is on for on_ms every period_ms. Set period_ms to 0 for a
+	 * continuous signal. */
+	int period_ms;
+	int on_ms;
+
+	/* If not 0, signal hops to a pseudo-random one of hop_num positions 
+	 * hop_step channels apart at the start of each period. */
+	int hop_num;
+	int hop_step;
+};
+
+struct dev_dummy_scenario {
+	/* Noise floor in 0.01 dBm */
+	short int floor;
+
+	/* Approximate standard deviation of measurement noise in 0.01 dB */
+	short int jitter;
+
+	const struct dev_dummy_signal* signal_list;
+	int signal_num;
+};
+
+struct dev_dummy_priv;
+
+typedef short int (*data_f)(const struct dev_dummy_priv* priv, int ch);
+
+struct dev_dummy_priv {
+	/* Return measurement for channel ch at the current time */
+	data_f get;
+
+	/* Scenario used by get_scenario() */
+	const struct dev_dummy_scenario* scenario;
+};
+
+/* Seed for the pseudo-random generator. Measurements are reproducible after
+ * a device reset or a change of configuration. */
+#define DEV_DUMMY_SEED	2463534242u
+
+/* xorshift32 pseudo-random generator state */
+static uint32_t dummy_rand_state;
+
+/* Emulated time in us since setup, advanced by channel_time_ms on each 
+ * measurement */
+static uint32_t dummy_time_us;
+
+/* Channel the device is tuned to */
+static int dummy_channel;
+
+static uint32_t dummy_xorshift(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static uint32_t dummy_rand(void)
+{
+	dummy_rand_state = dummy_xorshift(dummy_rand_state);
+	return dummy_rand_state;
+}
+
+/* Approximately normally distributed noise with standard deviation sigma,
+ * as sum of four uniformly distributed values. */
+static int dummy_noise(int sigma)
+{
+	if(sigma == 0) return 0;
+
+	/* uniform in [-a, a] has variance a^2/3. Sum of four has 4 a^2/3 */
+	int a = sigma * 7 / 8;
+	int sum = 0;
+	int n;
+	for(n = 0; n < 4; n++) {
+		sum += (int) (dummy_rand() % (2 * a + 1)) - a;
+	}
+
+	return sum;
+}
+
+static int dummy_signal_on(const struct dev_dummy_signal* signal, int ch)
+{
+	int first = signal->channel;
+
+	if(signal->period_ms > 0) {
+		uint32_t t = dummy_time_us / 1000;
+		uint32_t slot = t / signal->period_ms;
+
+		if(t % signal->period_ms >= (uint32_t) signal->on_ms) return 0;
+
+		if(signal->hop_num > 0) {
+			/* hopping sequence only depends on the time slot and
+			 * the seed, not on the order of measurements */
+			uint32_t h = dummy_xorshift(dummy_xorshift(slot ^ DEV_DUMMY_SEED));
+			first += (h % signal->hop_num) * signal->hop_step;
+		}
+	}
+
+	return ch >= first && ch < first + signal->width;
+}
+
+static short int get_zero(const struct dev_dummy_priv* priv __attribute__((unused)), 
+		int ch __attribute__((unused)))
+{
+	return 0;
+}
+
+static short int get_random(const struct dev_dummy_priv* priv __attribute__((unused)), 
+		int ch __attribute__((unused)))
+{
+	return -(dummy_rand() % 10000);
+}
+
+static short int get_scenario(const struct dev_dummy_priv* priv, int ch)
+{
+	const struct dev_dummy_scenario* scenario = priv->scenario;
+	int power = scenario->floor;
+
+	int n;
+	for(n = 0; n < scenario->signal_num; n++) {
+		const struct dev_dummy_signal* signal = &scenario->signal_list[n];
+		if(signal->power > power && dummy_signal_on(signal, ch)) {
+			power = signal->power;
+		}
+	}
+
+	return power + dummy_noise(scenario->jitter);
+}
+
+/* Advance emulated time by the duration of one measurement. */
+static void dummy_advance(const struct spectrum_dev_config* dev_config)
+{
+	dummy_time_us += dev_config->channel_time_ms * 1000;
+#ifdef DEV_DUMMY_REALTIME
+	int n;
+	for(n = 0; n < dev_config->channel_time_ms; n++) {
+		systick_udelay(1000);
+	}
+#endif
+}
+
 int dev_dummy_reset(void* priv __attribute__((unused)))
 {
+#ifdef DEV_DUMMY_REALTIME
+	systick_set_reload(0x00ffffff);
+	systick_set_clocksource(STK_CTRL_CLKSOURCE_AHB_DIV8);
+	systick_counter_enable();
+#endif
+	dummy_rand_state = DEV_DUMMY_SEED;
+	dummy_time_us = 0;
 	return E_SPECTRUM_OK;
 }
 
@@ -29,61 +185,60 @@ int dev_dummy_setup(void* priv __attribute__((unused)),
 		const struct spectrum_sweep_config* sweep_config 
 		__attribute__((unused))) 
 {
+	dummy_rand_state = DEV_DUMMY_SEED;
+	dummy_time_us = 0;
 	return E_SPECTRUM_OK;
 }
 
-typedef short int (*data_f)(void);
-
-static short int get_zero(void)
+int dev_dummy_tune(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		int channel)
 {
-	return 0;
+	dummy_channel = channel;
+	return E_SPECTRUM_OK;
 }
 
-static short int get_random(void)
+int dev_dummy_read_measure(void* priv __attribute__((unused)),
+		const struct spectrum_sweep_config* sweep_config,
+		short int* data)
 {
-	return -(rand() % 10000);
-}
+	const struct dev_dummy_priv* dev_priv = sweep_config->dev_config->priv;
 
-int dev_dummy_run(void* priv __attribute__((unused)),
-		const struct spectrum_sweep_config* sweep_config)
-{
-	int r, channel_num, n;
-	short int *data;
+	*data = dev_priv->get(dev_priv, dummy_channel);
+	dummy_advance(sweep_config->dev_config);
 
-	rtc_set_counter_val(0);
+	return E_SPECTRUM_OK;
+}
 
-	channel_num = spectrum_sweep_channel_num(sweep_config); 
-	data = calloc(channel_num, sizeof(*data));
-	if (data == NULL) {
-		return E_SPECTRUM_TOOMANY;
-	}
+int dev_dummy_zero_span_start(void* priv __attribute__((unused)),
+		const struct spectrum_zero_span_config* zero_span_config)
+{
+	dummy_channel = zero_span_config->channel;
+	return E_SPECTRUM_OK;
+}
 
-	do {
-		uint32_t rtc_counter = rtc_get_counter_val();
-		/* LSE clock is 32768 Hz. Prescaler is set to 16.
-		 *
-		 *                 rtc_counter * 16
-		 * t [ms] = 1000 * ----------------
-		 *                       32768
-		 */
-		int timestamp = ((long long) rtc_counter) * 1000 / 2048;
-
-		for(n = 0; n < channel_num; n++) {
-			data[n] = ((data_f) sweep_config->dev_config->priv)();
-		}
+int dev_dummy_zero_span_sample(void* priv __attribute__((unused)),
+		const struct spectrum_zero_span_config* zero_span_config,
+		short int* data)
+{
+	const struct dev_dummy_priv* dev_priv = zero_span_config->dev_config->priv;
 
-		r = sweep_config->cb(sweep_config, timestamp, data);
-	} while(!r);
+	*data = dev_priv->get(dev_priv, dummy_channel);
+	dummy_time_us += zero_span_config->interval_us;
 
-	free(data);
+	return E_SPECTRUM_OK;
+}
 
-	if (r == E_SPECTRUM_STOP_SWEEP) {
-		return E_SPECTRUM_OK;
-	} else {
-		return r;
-	}
+int dev_dummy_zero_span_stop(void* priv __attribute__((unused)),
+		const struct spectrum_zero_span_config* zero_span_config __attribute__((unused)))
+{
+	return E_SPECTRUM_OK;
 }
 
+static struct dev_dummy_priv dev_dummy_null_priv = {
+	.get			= get_zero
+};
+
 const struct spectrum_dev_config dev_dummy_null_config = {
 	.name			= "returns 0 dBm",
 
@@ -94,7 +249,11 @@ const struct spectrum_dev_config dev_dummy_null_config = {
 
 	.channel_time_ms	= 0,
 
-	.priv			= get_zero
+	.priv			= &dev_dummy_null_priv
+};
+
+static struct dev_dummy_priv dev_dummy_random_priv = {
+	.get			= get_random
 };
 
 const struct spectrum_dev_config dev_dummy_random_config = {
@@ -107,22 +266,159 @@ const struct spectrum_dev_config dev_dummy_random_config = {
 
 	.channel_time_ms	= 0,
 
-	.priv			= get_random
+	.priv			= &dev_dummy_random_priv
+};
+
+/* Scenarios below use a 2.4 GHz ISM band like channel plan: 1 MHz channels,
+ * 100 channels. */
+
+static const struct dev_dummy_scenario dev_dummy_noise_scenario = {
+	.floor			= -10000,
+	.jitter			= 200,
+	.signal_num		= 0
+};
+
+static struct dev_dummy_priv dev_dummy_noise_priv = {
+	.get			= get_scenario,
+	.scenario		= &dev_dummy_noise_scenario
+};
+
+const struct spectrum_dev_config dev_dummy_noise_config = {
+	.name			= "noise floor at -100 dBm",
+
+	.channel_base_hz 	= 2400000000LL,
+	.channel_spacing_hz	= 1000000,
+	.channel_bw_hz		= 1000000,
+	.channel_num		= 100,
+
+	.channel_time_ms	= 1,
+
+	.priv			= &dev_dummy_noise_priv
+};
+
+static const struct dev_dummy_signal dev_dummy_carrier_list[] = {
+	/* 20 MHz wide, strong */
+	{ .channel = 10, .width = 20, .power = -4000 },
+	/* narrow-band, weak */
+	{ .channel = 55, .width = 1, .power = -8500 },
+	{ .channel = 80, .width = 2, .power = -6000 },
+};
+
+static const struct dev_dummy_scenario dev_dummy_carrier_scenario = {
+	.floor			= -10000,
+	.jitter			= 200,
+	.signal_list		= dev_dummy_carrier_list,
+	.signal_num		= sizeof(dev_dummy_carrier_list)/sizeof(*dev_dummy_carrier_list)
+};
+
+static struct dev_dummy_priv dev_dummy_carrier_priv = {
+	.get			= get_scenario,
+	.scenario		= &dev_dummy_carrier_scenario
+};
+
+const struct spectrum_dev_config dev_dummy_carrier_config = {
+	.name			= "fixed carriers",
+
+	.channel_base_hz 	= 2400000000LL,
+	.channel_spacing_hz	= 1000000,
+	.channel_bw_hz		= 1000000,
+	.channel_num		= 100,
+
+	.channel_time_ms	= 1,
+
+	.priv			= &dev_dummy_carrier_priv
+};
+
+static const struct dev_dummy_signal dev_dummy_burst_list[] = {
+	/* 10% duty cycle, 1 s period */
+	{ .channel = 20, .width = 2, .power = -5000, .period_ms = 1000, .on_ms = 100 },
+	/* 50% duty cycle, 200 ms period */
+	{ .channel = 50, .width = 4, .power = -6000, .period_ms = 200, .on_ms = 100 },
+	/* short beacons */
+	{ .channel = 75, .width = 1, .power = -7000, .period_ms = 100, .on_ms = 3 },
+};
+
+static const struct dev_dummy_scenario dev_dummy_burst_scenario = {
+	.floor			= -10000,
+	.jitter			= 200,
+	.signal_list		= dev_dummy_burst_list,
+	.signal_num		= sizeof(dev_dummy_burst_list)/sizeof(*dev_dummy_burst_list)
+};
+
+static struct dev_dummy_priv dev_dummy_burst_priv = {
+	.get			= get_scenario,
+	.scenario		= &dev_dummy_burst_scenario
+};
+
+const struct spectrum_dev_config dev_dummy_burst_config = {
+	.name			= "bursty transmitters",
+
+	.channel_base_hz 	= 2400000000LL,
+	.channel_spacing_hz	= 1000000,
+	.channel_bw_hz		= 1000000,
+	.channel_num		= 100,
+
+	.channel_time_ms	= 1,
+
+	.priv			= &dev_dummy_burst_priv
+};
+
+static const struct dev_dummy_signal dev_dummy_hopper_list[] = {
+	/* Bluetooth-like: 79 positions, 1 MHz apart */
+	{ .channel = 2, .width = 1, .power = -6000, .period_ms = 5, .on_ms = 3,
+		.hop_num = 79, .hop_step = 1 },
+	/* slow hopper on 3 wide channels */
+	{ .channel = 5, .width = 20, .power = -7000, .period_ms = 500, .on_ms = 500,
+		.hop_num = 3, .hop_step = 25 },
+};
+
+static const struct dev_dummy_scenario dev_dummy_hopper_scenario = {
+	.floor			= -10000,
+	.jitter			= 200,
+	.signal_list		= dev_dummy_hopper_list,
+	.signal_num		= sizeof(dev_dummy_hopper_list)/sizeof(*dev_dummy_hopper_list)
+};
+
+static struct dev_dummy_priv dev_dummy_hopper_priv = {
+	.get			= get_scenario,
+	.scenario		= &dev_dummy_hopper_scenario
+};
+
+const struct spectrum_dev_config dev_dummy_hopper_config = {
+	.name			= "frequency hoppers",
+
+	.channel_base_hz 	= 2400000000LL,
+	.channel_spacing_hz	= 1000000,
+	.channel_bw_hz		= 1000000,
+	.channel_num		= 100,
+
+	.channel_time_ms	= 1,
+
+	.priv			= &dev_dummy_hopper_priv
 };
 
 const struct spectrum_dev_config* dev_dummy_config_list[] = {
 	&dev_dummy_null_config, 
-	&dev_dummy_random_config };
+	&dev_dummy_random_config,
+	&dev_dummy_noise_config,
+	&dev_dummy_carrier_config,
+	&dev_dummy_burst_config,
+	&dev_dummy_hopper_config };
 
 const struct spectrum_dev dev_dummy = {
 	.name = "dummy device",
 
 	.dev_config_list	= dev_dummy_config_list,
-	.dev_config_num		= 2,
+	.dev_config_num		= sizeof(dev_dummy_config_list)/sizeof(*dev_dummy_config_list),
 
 	.dev_reset		= dev_dummy_reset,
 	.dev_setup		= dev_dummy_setup,
-	.dev_run		= dev_dummy_run,
+	.dev_tune		= dev_dummy_tune,
+	.dev_read_measure	= dev_dummy_read_measure,
+
+	.dev_zero_span_start	= dev_dummy_zero_span_start,
+	.dev_zero_span_sample	= dev_dummy_zero_span_sample,
+	.dev_zero_span_stop	= dev_dummy_zero_span_stop,
 
 	.priv 			= NULL
 };
@@ -18,12 +18,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <libopencm3/stm32/exti.h>
 #include <libopencm3/stm32/f1/adc.h>
 #include <libopencm3/stm32/f1/gpio.h>
 #include <libopencm3/stm32/f1/rcc.h>
 #include <libopencm3/stm32/f1/rtc.h>
 #include <libopencm3/stm32/i2c.h>
-#include <libopencm3/stm32/iwdg.h>
+#include <libopencm3/stm32/nvic.h>
 #include <tda18219/tda18219.h>
 #include <tda18219/tda18219regs.h>
 
@@ -67,6 +68,27 @@ static int get_calibration_offset(const struct calibration_point* calibration, u
 	return offset;
 }
 
+/* Timeout for a single I2C transaction */
+#define TDA_I2C_TIMEOUT_MS	10
+
+/* Timeout for the TDA18219 IRQ line (covers RF calibration at power on) */
+#define TDA_IRQ_TIMEOUT_MS	1000
+
+static void setup_i2c(void)
+{
+	i2c_peripheral_disable(I2C1);
+
+	/* 400 kHz - I2C Fast Mode */
+	i2c_set_clock_frequency(I2C1, I2C_CR2_FREQ_24MHZ);
+	i2c_set_fast_mode(I2C1);
+	/* 400 kHz */
+	i2c_set_ccr(I2C1, 0x14);
+	/* 300 ns rise time */
+	i2c_set_trise(I2C1, 0x08);
+
+	i2c_peripheral_enable(I2C1);
+}
+
 static void setup_stm32f1_peripherals(void)
 {
 	rcc_peripheral_enable_clock(&RCC_APB1ENR, 
@@ -110,17 +132,24 @@ static void setup_stm32f1_peripherals(void)
 			GPIO_CNF_INPUT_ANALOG, TDA_PIN_OUT);
 
 	/* Setup I2C */
-	i2c_peripheral_disable(I2C1);
+	setup_i2c();
 
-	/* 400 kHz - I2C Fast Mode */
-	i2c_set_clock_frequency(I2C1, I2C_CR2_FREQ_24MHZ);
-	i2c_set_fast_mode(I2C1);
-	/* 400 kHz */
-	i2c_set_ccr(I2C1, 0x14);
-	/* 300 ns rise time */
-	i2c_set_trise(I2C1, 0x08);
+	nvic_enable_irq(NVIC_I2C1_EV_IRQ);
+	nvic_enable_irq(NVIC_I2C1_ER_IRQ);
 
-	i2c_peripheral_enable(I2C1);
+	/* TDA18219 IRQ line and RTC tick wake up the CPU from WFI */
+	rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_AFIOEN);
+
+	exti_select_source(TDA_EXTI_IRQ, GPIOA);
+	exti_set_trigger(TDA_EXTI_IRQ, EXTI_TRIGGER_RISING);
+	exti_enable_request(TDA_EXTI_IRQ);
+
+	nvic_enable_irq(TDA_NVIC_IRQ);
+	nvic_enable_irq(NVIC_RTC_IRQ);
+
+	/* Enabling RTC interrupts enters RTC configuration mode, which takes
+	 * several RTCCLK cycles. Do it once here, not in tda_wait(). */
+	rtc_interrupt_enable(RTC_SEC);
 
 
 	/* Make sure the ADC doesn't run during config. */
@@ -155,129 +184,291 @@ static void setup_stm32f1_peripherals(void)
 }
 
 
-int tda18219_read_reg(uint8_t reg, uint8_t* value)
+/* Sleep until done() returns true or timeout_ms passes.
+ *
+ * Return 0 on success or E_SPECTRUM_TIMEOUT. RTC second interrupt (enabled
+ * in setup_stm32f1_peripherals()) fires on each RTC counter tick (approx.
+ * every 0.5 ms) so that the timeout is checked even if no other interrupt
+ * arrives. */
+static int tda_wait(int (*done)(void), int timeout_ms)
 {
-	uint32_t __attribute__((unused)) reg32;
+	const uint32_t start = rtc_get_counter_val();
+	const uint32_t timeout = timeout_ms * 2048 / 1000 + 1;
 
-	/* Send START condition. */
-	i2c_send_start(I2C1);
+	int r = E_SPECTRUM_OK;
 
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(I2C1) & I2C_SR1_SB)
-		& (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
+	/* Interrupts are masked while checking the condition, so that an 
+	 * interrupt between the check and WFI still wakes us up. */
+	__asm__("cpsid i");
+	while(!done()) {
+		if(rtc_get_counter_val() - start > timeout) {
+			r = E_SPECTRUM_TIMEOUT;
+			break;
+		}
+		__asm__("wfi");
+		__asm__("cpsie i");
+		__asm__("cpsid i");
+	}
+	__asm__("cpsie i");
 
-	/* Say to what address we want to talk to. */
-	/* Yes, WRITE is correct - for selecting register in STTS75. */
-	i2c_send_7bit_address(I2C1, TDA18219_I2C_ADDR, I2C_WRITE);
+	return r;
+}
 
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(I2C1) & I2C_SR1_ADDR));
+void rtc_isr(void)
+{
+	rtc_clear_flag(RTC_SEC);
+}
 
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(I2C1);
+enum tda_i2c_state {
+	TDA_I2C_START,
+	TDA_I2C_ADDR,
+	TDA_I2C_REG,
+	TDA_I2C_DATA_WRITE,
+	TDA_I2C_START_READ,
+	TDA_I2C_ADDR_READ,
+	TDA_I2C_DATA_READ,
+	TDA_I2C_DONE
+};
 
-	i2c_send_data(I2C1, reg);
-	while (!(I2C_SR1(I2C1) & (I2C_SR1_BTF | I2C_SR1_TxE)));
+/* I2C transaction in progress. Register address is sent first, followed by
+ * len bytes written from tx or a repeated start and len bytes read into rx. */
+static struct {
+	uint8_t reg;
+	const uint8_t* tx;
+	uint8_t* rx;
+	int len;
+	int n;
 
-	/* Send re-START condition. */
-	i2c_send_start(I2C1);
+	volatile enum tda_i2c_state state;
+	volatile int result;
+} tda_i2c;
 
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(I2C1) & I2C_SR1_SB)
-		& (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
+static int tda_i2c_done(void)
+{
+	return tda_i2c.state == TDA_I2C_DONE;
+}
 
-	/* Say to what address we want to talk to. */
-	i2c_send_7bit_address(I2C1, TDA18219_I2C_ADDR, I2C_READ); 
+static void tda_i2c_finish(int result)
+{
+	I2C_CR2(I2C1) &= ~(I2C_CR2_ITEVTEN|I2C_CR2_ITBUFEN|I2C_CR2_ITERREN);
 
-	I2C_CR1(I2C1) &= ~I2C_CR1_ACK;
+	tda_i2c.result = result;
+	tda_i2c.state = TDA_I2C_DONE;
+}
 
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(I2C1) & I2C_SR1_ADDR));
+void i2c1_ev_isr(void)
+{
+	uint32_t sr1 = I2C_SR1(I2C1);
+	uint32_t __attribute__((unused)) reg32;
 
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(I2C1);
+	if(sr1 & I2C_SR1_SB) {
+		if(tda_i2c.state == TDA_I2C_START_READ) {
+			i2c_send_7bit_address(I2C1, TDA18219_I2C_ADDR, I2C_READ);
+			tda_i2c.state = TDA_I2C_ADDR_READ;
+		} else {
+			i2c_send_7bit_address(I2C1, TDA18219_I2C_ADDR, I2C_WRITE);
+			tda_i2c.state = TDA_I2C_ADDR;
+		}
+	} else if(sr1 & I2C_SR1_ADDR) {
+		if(tda_i2c.state == TDA_I2C_ADDR_READ) {
+			/* NACK must be set before ADDR is cleared if only 
+			 * one byte is to be received. */
+			if(tda_i2c.len == 1) {
+				I2C_CR1(I2C1) &= ~I2C_CR1_ACK;
+				reg32 = I2C_SR2(I2C1);
+				i2c_send_stop(I2C1);
+			} else {
+				I2C_CR1(I2C1) |= I2C_CR1_ACK;
+				reg32 = I2C_SR2(I2C1);
+			}
+			tda_i2c.state = TDA_I2C_DATA_READ;
+		} else {
+			reg32 = I2C_SR2(I2C1);
+			i2c_send_data(I2C1, tda_i2c.reg);
+			tda_i2c.state = TDA_I2C_REG;
+		}
+	} else if(sr1 & I2C_SR1_RxNE) {
+		tda_i2c.rx[tda_i2c.n++] = I2C_DR(I2C1);
+
+		if(tda_i2c.n == tda_i2c.len - 1) {
+			/* NACK the last byte */
+			I2C_CR1(I2C1) &= ~I2C_CR1_ACK;
+			i2c_send_stop(I2C1);
+		} else if(tda_i2c.n == tda_i2c.len) {
+			tda_i2c_finish(E_SPECTRUM_OK);
+		}
+	} else if(sr1 & (I2C_SR1_TxE|I2C_SR1_BTF)) {
+		if(tda_i2c.tx != NULL && tda_i2c.n < tda_i2c.len) {
+			i2c_send_data(I2C1, tda_i2c.tx[tda_i2c.n++]);
+			tda_i2c.state = TDA_I2C_DATA_WRITE;
+		} else if(!(sr1 & I2C_SR1_BTF)) {
+			/* Wait until the last byte is actually out on the
+			 * bus. Disable TxE interrupt until then. */
+			I2C_CR2(I2C1) &= ~I2C_CR2_ITBUFEN;
+		} else if(tda_i2c.rx != NULL) {
+			i2c_send_start(I2C1);
+			I2C_CR2(I2C1) |= I2C_CR2_ITBUFEN;
+			tda_i2c.state = TDA_I2C_START_READ;
+		} else {
+			i2c_send_stop(I2C1);
+			tda_i2c_finish(E_SPECTRUM_OK);
+		}
+	}
+}
 
-	i2c_send_stop(I2C1);
+void i2c1_er_isr(void)
+{
+	uint32_t sr1 = I2C_SR1(I2C1);
 
-	while (!(I2C_SR1(I2C1) & I2C_SR1_RxNE));
+	I2C_SR1(I2C1) = sr1 & ~(I2C_SR1_BERR|I2C_SR1_ARLO|I2C_SR1_AF|
+			I2C_SR1_OVR|I2C_SR1_TIMEOUT);
 
-	*value = I2C_DR(I2C1);
+	if(sr1 & I2C_SR1_AF) {
+		i2c_send_stop(I2C1);
+	}
 
-	return 0;
+	tda_i2c_finish(E_SPECTRUM_IO);
 }
 
-int tda18219_write_reg(uint8_t reg, uint8_t value)
+static int tda_i2c_transfer(uint8_t reg, const uint8_t* tx, uint8_t* rx, int len)
 {
-	uint32_t __attribute__((unused)) reg32;
+	if(len <= 0) {
+		return E_SPECTRUM_INVALID;
+	}
 
-	/* Send START condition. */
+	tda_i2c.reg = reg;
+	tda_i2c.tx = tx;
+	tda_i2c.rx = rx;
+	tda_i2c.len = len;
+	tda_i2c.n = 0;
+	tda_i2c.state = TDA_I2C_START;
+	tda_i2c.result = E_SPECTRUM_OK;
+
+	I2C_CR2(I2C1) |= I2C_CR2_ITEVTEN|I2C_CR2_ITBUFEN|I2C_CR2_ITERREN;
 	i2c_send_start(I2C1);
 
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(I2C1) & I2C_SR1_SB)
-		& (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
+	int r = tda_wait(tda_i2c_done, TDA_I2C_TIMEOUT_MS);
+	if(r) {
+		tda_i2c_finish(r);
+	}
 
-	/* Say to what address we want to talk to. */
-	/* Yes, WRITE is correct - for selecting register in STTS75. */
-	i2c_send_7bit_address(I2C1, TDA18219_I2C_ADDR, I2C_WRITE);
+	if(tda_i2c.result) {
+		/* Reset the peripheral in case it got stuck in the middle of 
+		 * a transaction. */
+		I2C_CR1(I2C1) |= I2C_CR1_SWRST;
+		I2C_CR1(I2C1) &= ~I2C_CR1_SWRST;
+		setup_i2c();
+	}
 
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(I2C1) & I2C_SR1_ADDR));
+	return tda_i2c.result;
+}
 
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(I2C1);
+/* Read len consecutive registers starting at reg in a single transaction */
+int tda18219_read_regs(uint8_t reg, uint8_t* values, int len)
+{
+	return tda_i2c_transfer(reg, NULL, values, len);
+}
 
-	i2c_send_data(I2C1, reg);
-	while (!(I2C_SR1(I2C1) & I2C_SR1_TxE));
+/* Write len consecutive registers starting at reg in a single transaction */
+int tda18219_write_regs(uint8_t reg, const uint8_t* values, int len)
+{
+	return tda_i2c_transfer(reg, values, NULL, len);
+}
 
-	i2c_send_data(I2C1, value);
-	while (!(I2C_SR1(I2C1) & (I2C_SR1_BTF | I2C_SR1_TxE)));
+int tda18219_read_reg(uint8_t reg, uint8_t* value)
+{
+	return tda18219_read_regs(reg, value, 1);
+}
 
-	i2c_send_stop(I2C1);
+int tda18219_write_reg(uint8_t reg, uint8_t value)
+{
+	return tda18219_write_regs(reg, &value, 1);
+}
 
-	return 0;
+static int tda_irq_high(void)
+{
+	return gpio_get(GPIOA, TDA_PIN_IRQ) ? 1 : 0;
+}
+
+void TDA_ISR_IRQ(void)
+{
+	exti_reset_request(TDA_EXTI_IRQ);
 }
 
 int tda18219_wait_irq(void)
 {
-	while(!gpio_get(GPIOA, TDA_PIN_IRQ));
+	return tda_wait(tda_irq_high, TDA_IRQ_TIMEOUT_MS);
+}
+
+
+/* Set if the tuner and the AD8307 detector are powered on */
+static int tda_powered = 0;
+
+static int dev_tda18219_power_on(void)
+{
+	if(!tda_powered) {
+		int r = tda18219_power_on();
+		if(r) return r;
 
-	return 0;
+		gpio_set(GPIOA, TDA_PIN_ENB);
+		tda_powered = 1;
+	}
+
+	return E_SPECTRUM_OK;
 }
 
+int dev_tda18219_standby(void* priv __attribute__((unused)))
+{
+	if(tda_powered) {
+		gpio_clear(GPIOA, TDA_PIN_ENB);
+		tda_powered = 0;
+
+		return tda18219_power_standby();
+	}
+
+	return E_SPECTRUM_OK;
+}
 
 int dev_tda18219_reset(void* priv __attribute__((unused))) 
 {
+	int r;
+
 	setup_stm32f1_peripherals();
-	tda18219_power_on();
-	tda18219_init();
-	tda18219_power_standby();
-	return E_SPECTRUM_OK;
+
+	tda_powered = 0;
+
+	r = dev_tda18219_power_on();
+	if(r) return r;
+	r = tda18219_init();
+	if(r) return r;
+
+	return dev_tda18219_standby(NULL);
 }
 
+/* Tuner is left powered on. spectrum_run puts it into standby after the
+ * sweep unless it is kept warm. */
 int dev_tda18219_setup(void* priv __attribute__((unused)), const struct spectrum_sweep_config* sweep_config) 
 {
 	const struct dev_tda18219_priv* dev_priv = sweep_config->dev_config->priv;
 
-	tda18219_power_on();
-	tda18219_set_standard(dev_priv->standard);
-	tda18219_power_standby();
-	return E_SPECTRUM_OK;
+	int r;
+
+	r = dev_tda18219_power_on();
+	if(r) return r;
+
+	return tda18219_set_standard(dev_priv->standard);
 }
 
-static int dev_tda18219_get_ad8307_input_power(void)
+static int dev_tda18219_get_ad8307_sample(void)
 {
-	const int nsamples = 100;
-
-	int acc = 0;
-	int n;
-	for(n = 0; n < nsamples; n++) {
-		adc_on(ADC1);
-		while (!(ADC_SR(ADC1) & ADC_SR_EOC));
-		acc += ADC_DR(ADC1);
-	}
-	acc /= nsamples;
+	adc_on(ADC1);
+	while (!(ADC_SR(ADC1) & ADC_SR_EOC));
+	return ADC_DR(ADC1);
+}
 
+/* Convert an AD converter reading to input power */
+static int dev_tda18219_ad8307_to_dbm_100(int acc)
+{
 	/* STM32F1 has a 12 bit AD converter. Low reference is 0 V, high is 3.3 V
 	 *
 	 *              3.3 V
@@ -311,74 +502,91 @@ static int dev_tda18219_get_ad8307_input_power(void)
 	return acc * 3300 / 1024 - 15000;
 }
 
-int dev_tda18219_run(void* priv __attribute__((unused)), const struct spectrum_sweep_config* sweep_config)
+static int dev_tda18219_get_ad8307_input_power(void)
 {
-	const struct dev_tda18219_priv* dev_priv = sweep_config->dev_config->priv;
+	const int nsamples = 100;
 
-	int r;
-	short int *data;
+	int acc = 0;
+	int n;
+	for(n = 0; n < nsamples; n++) {
+		acc += dev_tda18219_get_ad8307_sample();
+	}
+	acc /= nsamples;
 
-	rtc_set_counter_val(0);
+	return dev_tda18219_ad8307_to_dbm_100(acc);
+}
 
-	int channel_num = spectrum_sweep_channel_num(sweep_config);
-	data = calloc(channel_num, sizeof(*data));
-	if (data == NULL) {
-		return E_SPECTRUM_TOOMANY;
-	}
+/* Calibration offset for the channel the tuner is currently tuned to */
+static int tune_offset;
 
-	tda18219_power_on();
-	gpio_set(GPIOA, TDA_PIN_ENB);
-
-	do {
-		IWDG_KR = IWDG_KR_RESET;
-		uint32_t rtc_counter = rtc_get_counter_val();
-		/* LSE clock is 32768 Hz. Prescaler is set to 16.
-		 *
-		 *                 rtc_counter * 16
-		 * t [ms] = 1000 * ----------------
-		 *                       32768
-		 */
-		int timestamp = ((long long) rtc_counter) * 1000 / 2048;
-
-		int n, ch;
-		for(		ch = sweep_config->channel_start, n = 0; 
-				ch < sweep_config->channel_stop && n < channel_num; 
-				ch += sweep_config->channel_step, n++) {
-			int freq = sweep_config->dev_config->channel_base_hz + \
-				   	sweep_config->dev_config->channel_spacing_hz * ch;
-			tda18219_set_frequency(dev_priv->standard,
-					freq);
-
-			uint8_t rssi_dbuv;
-			tda18219_get_input_power_sync(&rssi_dbuv);
-
-			int rssi_dbm_100;
-			if(rssi_dbuv < 40) {
-				// internal power detector in TDA18219 doesn't go below 40 dBuV
-				rssi_dbm_100 = dev_tda18219_get_ad8307_input_power();
-			} else {
-				// P [dBm] = U [dBuV] - 90 - 10 log 75 ohm
-				rssi_dbm_100 = rssi_dbuv * 100 - 9000 - 1875;
-			}
+static int tda_tune(const struct spectrum_dev_config* dev_config, int channel)
+{
+	const struct dev_tda18219_priv* dev_priv = dev_config->priv;
 
-			// extra offset determined by measurement
-			rssi_dbm_100 -= get_calibration_offset(dev_priv->calibration, freq / 1000);
+	int r = dev_tda18219_power_on();
+	if(r) return r;
 
-			data[n] = rssi_dbm_100;
-		}
-		r = sweep_config->cb(sweep_config, timestamp, data);
-	} while(!r);
+	int freq = dev_config->channel_base_hz + \
+		   dev_config->channel_spacing_hz * channel;
+
+	r = tda18219_set_frequency(dev_priv->standard, freq);
+	if(r) return r;
 
-	gpio_clear(GPIOA, TDA_PIN_ENB);
-	tda18219_power_standby();
+	// extra offset determined by measurement
+	tune_offset = get_calibration_offset(dev_priv->calibration, freq / 1000);
+
+	return E_SPECTRUM_OK;
+}
 
-	free(data);
+int dev_tda18219_tune(void* priv __attribute__((unused)), 
+		const struct spectrum_sweep_config* sweep_config, int channel)
+{
+	return tda_tune(sweep_config->dev_config, channel);
+}
 
-	if (r == E_SPECTRUM_STOP_SWEEP) {
-		return E_SPECTRUM_OK;
+int dev_tda18219_read_measure(void* priv __attribute__((unused)), 
+		const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		short int* data)
+{
+	uint8_t rssi_dbuv;
+	int r = tda18219_get_input_power_sync(&rssi_dbuv);
+	if(r) return r;
+
+	int rssi_dbm_100;
+	if(rssi_dbuv < 40) {
+		// internal power detector in TDA18219 doesn't go below 40 dBuV
+		rssi_dbm_100 = dev_tda18219_get_ad8307_input_power();
 	} else {
-		return r;
+		// P [dBm] = U [dBuV] - 90 - 10 log 75 ohm
+		rssi_dbm_100 = rssi_dbuv * 100 - 9000 - 1875;
 	}
+
+	*data = rssi_dbm_100 - tune_offset;
+
+	return E_SPECTRUM_OK;
+}
+
+int dev_tda18219_zero_span_start(void* priv __attribute__((unused)), 
+		const struct spectrum_zero_span_config* zero_span_config)
+{
+	return tda_tune(zero_span_config->dev_config, zero_span_config->channel);
+}
+
+/* Only AD8307 is used in zero-span, since reading the TDA18219 internal power
+ * detector takes several I2C transactions. */
+int dev_tda18219_zero_span_sample(void* priv __attribute__((unused)), 
+		const struct spectrum_zero_span_config* zero_span_config __attribute__((unused)),
+		short int* data)
+{
+	*data = dev_tda18219_ad8307_to_dbm_100(dev_tda18219_get_ad8307_sample()) - 
+		tune_offset;
+	return E_SPECTRUM_OK;
+}
+
+int dev_tda18219_zero_span_stop(void* priv __attribute__((unused)), 
+		const struct spectrum_zero_span_config* zero_span_config __attribute__((unused)))
+{
+	return E_SPECTRUM_OK;
 }
 
 void dev_tda18219_print_status(void)
@@ -544,7 +752,13 @@ static const struct spectrum_dev dev_tda18219 = {
 
 	.dev_reset		= dev_tda18219_reset,
 	.dev_setup		= dev_tda18219_setup,
-	.dev_run		= dev_tda18219_run,
+	.dev_tune		= dev_tda18219_tune,
+	.dev_read_measure	= dev_tda18219_read_measure,
+	.dev_standby		= dev_tda18219_standby,
+
+	.dev_zero_span_start	= dev_tda18219_zero_span_start,
+	.dev_zero_span_sample	= dev_tda18219_zero_span_sample,
+	.dev_zero_span_stop	= dev_tda18219_zero_span_stop,
 
 	.priv 			= NULL
 };
@@ -21,8 +21,13 @@
 #define TDA_PIN_SCL	GPIO8
 #define TDA_PIN_SDA	GPIO9
 
+#include <stdint.h>
+
 #ifdef MODEL_SNE_CREWTV
 #	define TDA_PIN_IRQ	GPIO7
+#	define TDA_EXTI_IRQ	EXTI7
+#	define TDA_NVIC_IRQ	NVIC_EXTI9_5_IRQ
+#	define TDA_ISR_IRQ	exti9_5_isr
 #	define TDA_PIN_IF_AGC	GPIO4
 #	define TDA_PIN_ENB	GPIO6
 #	define TDA_PIN_OUT	GPIO0
@@ -30,11 +35,17 @@
 
 #ifdef MODEL_SNE_ISMTV_UHF
 #	define TDA_PIN_IRQ	GPIO1
+#	define TDA_EXTI_IRQ	EXTI1
+#	define TDA_NVIC_IRQ	NVIC_EXTI1_IRQ
+#	define TDA_ISR_IRQ	exti1_isr
 #	define TDA_PIN_IF_AGC	GPIO4
 #	define TDA_PIN_ENB	GPIO0
 #	define TDA_PIN_OUT	GPIO2
 #endif
 
+int tda18219_read_regs(uint8_t reg, uint8_t* values, int len);
+int tda18219_write_regs(uint8_t reg, const uint8_t* values, int len);
+
 int dev_tda18219_register(void);
 void dev_tda18219_print_status(void);
 
@@ -0,0 +1,400 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+
+/* Log-structured storage of sweeps in flash */
+
+#include <stdlib.h>
+#include "spectrum.h"
+#include "flash-log.h"
+
+static const struct flash_log_page* flash_log_get_page(const struct flash_log* log, int page)
+{
+	return (const struct flash_log_page*) (log->region->base + page * log->region->page_size);
+}
+
+static int flash_log_get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t flash_log_get32(const uint8_t* p)
+{
+	return flash_log_get16(p) | ((uint32_t) flash_log_get16(p + 2) << 16);
+}
+
+static uint8_t* flash_log_put16(uint8_t* p, uint16_t v)
+{
+	*p++ = v;
+	*p++ = v >> 8;
+	return p;
+}
+
+static uint8_t* flash_log_put32(uint8_t* p, uint32_t v)
+{
+	p = flash_log_put16(p, v);
+	return flash_log_put16(p, v >> 16);
+}
+
+static uint8_t* flash_log_put_varint(uint8_t* p, uint32_t v)
+{
+	while(v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/* Walk over frames in page, calling cb for each frame if cb is not NULL. If cb
+ * returns non-zero, store its return value in r and stop.
+ *
+ * Return offset of free space after the last frame, or page size if the rest
+ * of the page can't be used. */
+static int flash_log_walk_page(const struct flash_log* log, int page,
+		flash_log_cb_t cb, void* priv, int* r)
+{
+	const struct flash_region* region = log->region;
+	const uint8_t* p = region->base + page * region->page_size;
+	int offset = sizeof(struct flash_log_page);
+
+	while(offset + 2 <= region->page_size) {
+		int len = flash_log_get16(&p[offset]);
+
+		if (len == 0xffff) {
+			/* frame data written before a reset, but without length */
+			if (!flash_is_erased(region, page * region->page_size + offset,
+						region->page_size - offset)) {
+				return region->page_size;
+			}
+			return offset;
+		}
+
+		int next = offset + 2 + ((len + 1) & ~1);
+		if (next > region->page_size) {
+			return region->page_size;
+		}
+
+		if (cb != NULL) {
+			*r = cb(priv, &p[offset + 2], len);
+			if (*r) return offset;
+		}
+
+		offset = next;
+	}
+
+	return offset;
+}
+
+static int flash_log_session_cb(void* priv, const uint8_t* data, int len)
+{
+	struct flash_log* log = priv;
+
+	if (len >= 6 && data[0] == FLASH_LOG_SESSION) {
+		log->session = flash_log_get32(&data[2]);
+	}
+
+	return 0;
+}
+
+/* Find the end of the log in region.
+ *
+ * Return 0 on success, or error code otherwise. */
+int flash_log_init(struct flash_log* log, const struct flash_region* region)
+{
+	log->region = region;
+	log->page = -1;
+	log->offset = 0;
+	log->seq = 0;
+	log->first_seq = 1;
+	log->erase_max = 0;
+	log->session = 0;
+
+	if (log->buf == NULL) {
+		log->buf = malloc(region->page_size);
+		if (log->buf == NULL) {
+			return E_SPECTRUM_TOOMANY;
+		}
+	}
+
+	int page;
+	for(page = 0; page < region->page_num; page++) {
+		const struct flash_log_page* hdr = flash_log_get_page(log, page);
+		if (hdr->magic != FLASH_LOG_MAGIC) continue;
+
+		if (hdr->erase_num > log->erase_max) {
+			log->erase_max = hdr->erase_num;
+		}
+
+		if (log->page < 0 || hdr->seq > log->seq) {
+			log->page = page;
+			log->seq = hdr->seq;
+			log->first_seq = hdr->first_seq;
+		}
+	}
+
+	if (log->page >= 0) {
+		int r;
+		log->offset = flash_log_walk_page(log, log->page, NULL, NULL, &r);
+	}
+
+	flash_log_iterate(log, flash_log_session_cb, log);
+
+	return E_SPECTRUM_OK;
+}
+
+/* Erase the page following the current one if necessary and start writing
+ * into it. */
+static int flash_log_new_page(struct flash_log* log)
+{
+	const struct flash_region* region = log->region;
+	int page = (log->page + 1) % region->page_num;
+	int r;
+
+	const struct flash_log_page* old_hdr = flash_log_get_page(log, page);
+
+	uint32_t erase_num = 0;
+	if (old_hdr->magic == FLASH_LOG_MAGIC) {
+		erase_num = old_hdr->erase_num;
+	}
+
+	if (!flash_is_erased(region, page * region->page_size, region->page_size)) {
+		r = region->erase_page(region, page);
+		if (r) return r;
+
+		erase_num++;
+	}
+
+	struct flash_log_page hdr = {
+		.magic		= FLASH_LOG_MAGIC,
+		.seq		= log->seq + 1,
+		.first_seq	= log->first_seq,
+		.erase_num	= erase_num
+	};
+
+	/* magic is written last, so that a partially written header is ignored */
+	r = region->program(region, page * region->page_size + sizeof(hdr.magic),
+			&hdr.seq, sizeof(hdr) - sizeof(hdr.magic));
+	if (!r) {
+		r = region->program(region, page * region->page_size,
+				&hdr.magic, sizeof(hdr.magic));
+	}
+
+	log->page = page;
+	log->seq = hdr.seq;
+
+	if (erase_num > log->erase_max) {
+		log->erase_max = erase_num;
+	}
+
+	if (r) {
+		log->offset = region->page_size;
+		return r;
+	}
+
+	log->offset = sizeof(hdr);
+
+	return E_SPECTRUM_OK;
+}
+
+/* Append a frame of len bytes to the log.
+ *
+ * Return 0 on success, or error code otherwise. */
+int flash_log_append(struct flash_log* log, const uint8_t* data, int len)
+{
+	const struct flash_region* region = log->region;
+	int size = 2 + ((len + 1) & ~1);
+	int r;
+
+	if (len <= 0 || len >= 0xffff) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (sizeof(struct flash_log_page) + size > (unsigned) region->page_size) {
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	if (log->page < 0 || log->offset + size > region->page_size) {
+		r = flash_log_new_page(log);
+		if (r) return r;
+	}
+
+	int offset = log->page * region->page_size + log->offset;
+	int even_len = len & ~1;
+
+	/* a failed write leaves garbage in the page, continue on the next one */
+	log->offset = region->page_size;
+
+	if (even_len > 0) {
+		r = region->program(region, offset + 2, data, even_len);
+		if (r) return r;
+	}
+
+	if (len & 1) {
+		uint8_t last[2] = { data[len - 1], 0xff };
+		r = region->program(region, offset + 2 + even_len, last, 2);
+		if (r) return r;
+	}
+
+	uint8_t len_data[2];
+	flash_log_put16(len_data, len);
+	r = region->program(region, offset, len_data, 2);
+	if (r) return r;
+
+	log->offset = offset - log->page * region->page_size + size;
+
+	return E_SPECTRUM_OK;
+}
+
+static int flash_log_gcd(int a, int b)
+{
+	while(b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Append a single sweep frame with channel_num measurements, starting with
+ * channel_start. */
+static int flash_log_append_sweep_frame(struct flash_log* log, int dev_id, int config_id,
+		int channel_start, int channel_step, int channel_num, int timestamp,
+		const short int data_list[])
+{
+	int n;
+
+	int scale = 0;
+	for(n = 0; n < channel_num; n++) {
+		scale = flash_log_gcd(abs(data_list[n]), scale);
+	}
+	if (scale == 0) {
+		scale = 1;
+	}
+
+	uint8_t* p = log->buf;
+	*p++ = FLASH_LOG_SWEEP;
+	*p++ = dev_id;
+	*p++ = config_id;
+	p = flash_log_put16(p, scale);
+	p = flash_log_put32(p, timestamp);
+	p = flash_log_put16(p, channel_start);
+	p = flash_log_put16(p, channel_step);
+	p = flash_log_put16(p, channel_num);
+
+	int prev = 0;
+	for(n = 0; n < channel_num; n++) {
+		int v = data_list[n] / scale;
+		int d = v - prev;
+
+		p = flash_log_put_varint(p, d >= 0 ? 2 * d : -2 * d - 1);
+		prev = v;
+	}
+
+	return flash_log_append(log, log->buf, p - log->buf);
+}
+
+/* Append a compressed sweep to the log (see FLASH_LOG_SWEEP), split into as
+ * many frames as necessary.
+ *
+ * Return 0 on success, or error code otherwise. */
+int flash_log_append_sweep(struct flash_log* log, int dev_id, int config_id,
+		const struct spectrum_sweep_config* sweep_config, int timestamp,
+		const short int data_list[])
+{
+	int channel_num = spectrum_sweep_channel_num(sweep_config);
+	int channel_step = sweep_config->channel_step;
+
+	/* frame length, header and up to 3 bytes per measurement, padded to an
+	 * even length, must fit in a page */
+	int frame_max = (log->region->page_size - (int) sizeof(struct flash_log_page) - 2 - 16) / 3;
+	if (frame_max <= 0) {
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	int n;
+	for(n = 0; n < channel_num; n += frame_max) {
+		int num = channel_num - n;
+		if (num > frame_max) {
+			num = frame_max;
+		}
+
+		int r = flash_log_append_sweep_frame(log, dev_id, config_id,
+				sweep_config->channel_start + n * channel_step, channel_step,
+				num, timestamp, &data_list[n]);
+		if (r) return r;
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+/* Append a session marker to the log (see FLASH_LOG_SESSION).
+ *
+ * Return 0 on success, or error code otherwise. */
+int flash_log_append_session(struct flash_log* log, int flags)
+{
+	uint8_t* p = log->buf;
+	*p++ = FLASH_LOG_SESSION;
+	*p++ = flags;
+	p = flash_log_put32(p, log->session + 1);
+
+	int r = flash_log_append(log, log->buf, p - log->buf);
+	if (r) return r;
+
+	log->session++;
+
+	return E_SPECTRUM_OK;
+}
+
+/* Remove all frames from the log.
+ *
+ * Return 0 on success, or error code otherwise. */
+int flash_log_erase(struct flash_log* log)
+{
+	log->first_seq = log->seq + 1;
+	return flash_log_new_page(log);
+}
+
+/* Call cb for each frame in the log, starting with the oldest.
+ *
+ * Return 0 on success, or the first non-zero value returned by cb. */
+int flash_log_iterate(const struct flash_log* log, flash_log_cb_t cb, void* priv)
+{
+	const struct flash_region* region = log->region;
+
+	if (log->page < 0) {
+		return E_SPECTRUM_OK;
+	}
+
+	uint32_t seq = log->first_seq;
+	if (log->seq - seq >= (unsigned) region->page_num) {
+		seq = log->seq - region->page_num + 1;
+	}
+
+	for(; seq <= log->seq; seq++) {
+		int page = (log->page + region->page_num - (log->seq - seq)) % region->page_num;
+
+		const struct flash_log_page* hdr = flash_log_get_page(log, page);
+		if (hdr->magic != FLASH_LOG_MAGIC || hdr->seq != seq) continue;
+
+		int r = 0;
+		flash_log_walk_page(log, page, cb, priv, &r);
+		if (r) return r;
+	}
+
+	return E_SPECTRUM_OK;
+}
@@ -0,0 +1,126 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+#ifndef HAVE_FLASH_LOG_H
+#define HAVE_FLASH_LOG_H
+
+#include <stdint.h>
+#include "flash.h"
+
+struct spectrum_sweep_config;
+
+/* Log of variable-length frames in a flash region.
+ *
+ * Each page starts with a flash_log_page header, followed by frames:
+ *
+ * len -- 16-bit frame length in bytes
+ * data -- len bytes, padded to an even length
+ *
+ * Frame data is programmed before its length, so a write interrupted by a
+ * reset leaves the length erased and the frame is ignored. Pages are used in
+ * a circle: when the log reaches a used page, that page is erased and its
+ * frames, the oldest in the log, are lost. Since pages are always reused in
+ * the same order, all pages wear evenly. Erasing the log only starts a new
+ * page and marks older pages as outside the log, so it costs one page erase. */
+struct flash_log_page {
+	uint32_t magic;
+
+	/* Sequence number of the page, increases by one for each new page */
+	uint32_t seq;
+
+	/* Sequence number of the first page in the log */
+	uint32_t first_seq;
+
+	/* Number of times this page has been erased */
+	uint32_t erase_num;
+};
+
+#define FLASH_LOG_MAGIC		0x474c5356
+
+struct flash_log {
+	const struct flash_region* region;
+
+	/* Page currently written to, -1 if the log is empty */
+	int page;
+
+	/* Offset of the next frame in the current page */
+	int offset;
+
+	/* Sequence number of the current page */
+	uint32_t seq;
+
+	/* Sequence number of the first page in the log */
+	uint32_t first_seq;
+
+	/* Largest erase count of all pages */
+	uint32_t erase_max;
+
+	/* Number of the last session marker in the log */
+	uint32_t session;
+
+	/* Buffer for encoding frames */
+	uint8_t* buf;
+};
+
+/* Sweep frame format:
+ *
+ * type -- 8-bit FLASH_LOG_SWEEP
+ * dev_id, config_id -- 8-bit device and configuration
+ * scale -- 16-bit measurement unit in 0.01 dB
+ * timestamp -- 32-bit time in ms since sweep start
+ * channel_start, channel_step, channel_num -- 16-bit
+ * data -- channel_num variable-length integers
+ *
+ * All fields are little-endian. Each measurement is stored as the difference
+ * from the previous measurement (the first from 0), in units of scale,
+ * zig-zag encoded (0, -1, 1, -2, 2, ... map to 0, 1, 2, 3, 4, ...) and
+ * written 7 bits per byte, least significant first, with the top bit set on
+ * all but the last byte. scale is the greatest common divisor of all
+ * measurements in the sweep, which is larger than 1 for devices with a coarse
+ * power resolution (e.g. 50 for CC devices).
+ *
+ * A sweep with too many channels to fit in a page is split into several
+ * frames with the same timestamp, each covering consecutive channels. */
+#define FLASH_LOG_SWEEP		1
+
+/* Session marker frame format:
+ *
+ * type -- 8-bit FLASH_LOG_SESSION
+ * flags -- 8-bit, FLASH_LOG_SESSION_BOOT set on the first session after reset
+ * session -- 32-bit session number, increases by one for each marker
+ *
+ * A marker precedes the sweeps of each run, since timestamps restart from 0
+ * at the start of a run. */
+#define FLASH_LOG_SESSION	2
+
+#define FLASH_LOG_SESSION_BOOT	1
+
+int flash_log_init(struct flash_log* log, const struct flash_region* region);
+int flash_log_append(struct flash_log* log, const uint8_t* data, int len);
+int flash_log_append_sweep(struct flash_log* log, int dev_id, int config_id,
+		const struct spectrum_sweep_config* sweep_config, int timestamp,
+		const short int data_list[]);
+int flash_log_append_session(struct flash_log* log, int flags);
+int flash_log_erase(struct flash_log* log);
+
+/* Return 0 to continue or any other value to stop and return from
+ * flash_log_iterate. */
+typedef int (*flash_log_cb_t)(void* priv, const uint8_t* data, int len);
+
+int flash_log_iterate(const struct flash_log* log, flash_log_cb_t cb, void* priv);
+
+#endif
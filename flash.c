@@ -0,0 +1,172 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+
+/* Internal flash regions for application data.
+ *
+ * With FLASH_RAM defined, regions are backed by RAM arrays that emulate flash
+ * programming rules. This allows the code using them to run on the host or
+ * without wearing out the flash. */
+
+#include <string.h>
+#include "spectrum.h"
+#include "flash.h"
+
+#ifndef FLASH_RAM
+#include <libopencm3/stm32/f1/flash.h>
+#endif
+
+/* Return 1 if len bytes at offset in region are erased. */
+int flash_is_erased(const struct flash_region* region, int offset, int len)
+{
+	const uint8_t* p = region->base + offset;
+	int n;
+	for(n = 0; n < len; n++) {
+		if (p[n] != 0xff) return 0;
+	}
+	return 1;
+}
+
+static int flash_check_program(const struct flash_region* region, int offset, int len)
+{
+	if (offset < 0 || len < 0 || (offset & 1) || (len & 1) ||
+			offset + len > region->page_size * region->page_num) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+#ifdef FLASH_RAM
+
+static uint8_t flash_ram_log[FLASH_LOG_PAGE_NUM * FLASH_PAGE_SIZE];
+static uint8_t flash_ram_settings[FLASH_PAGE_SIZE];
+
+static int flash_ram_erase_page(const struct flash_region* region, int page)
+{
+	if (page < 0 || page >= region->page_num) return E_SPECTRUM_INVALID;
+
+	memset(region->base + page * region->page_size, 0xff, region->page_size);
+
+	return E_SPECTRUM_OK;
+}
+
+static int flash_ram_program(const struct flash_region* region, int offset,
+		const void* data, int len)
+{
+	int r = flash_check_program(region, offset, len);
+	if (r) return r;
+
+	uint8_t* p = region->base + offset;
+	const uint8_t* d = data;
+
+	int n;
+	for(n = 0; n < len; n += 2) {
+		/* like STM32 PGERR, only erased half-words can be programmed */
+		if (p[n] != 0xff || p[n+1] != 0xff) return E_SPECTRUM_IO;
+
+		p[n] = d[n];
+		p[n+1] = d[n+1];
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+const struct flash_region flash_log_region = {
+	.base		= flash_ram_log,
+	.page_size	= FLASH_PAGE_SIZE,
+	.page_num	= FLASH_LOG_PAGE_NUM,
+	.erase_page	= flash_ram_erase_page,
+	.program	= flash_ram_program
+};
+
+const struct flash_region flash_settings_region = {
+	.base		= flash_ram_settings,
+	.page_size	= FLASH_PAGE_SIZE,
+	.page_num	= 1,
+	.erase_page	= flash_ram_erase_page,
+	.program	= flash_ram_program
+};
+
+#else
+
+/* Must match the end of rom in vesna.ld */
+#define FLASH_END		0x08080000
+
+#define FLASH_SETTINGS_BASE	(FLASH_END - FLASH_PAGE_SIZE)
+#define FLASH_LOG_BASE		(FLASH_SETTINGS_BASE - FLASH_LOG_PAGE_NUM * FLASH_PAGE_SIZE)
+
+static int flash_stm32_erase_page(const struct flash_region* region, int page)
+{
+	if (page < 0 || page >= region->page_num) return E_SPECTRUM_INVALID;
+
+	int offset = page * region->page_size;
+
+	flash_unlock();
+	flash_erase_page((u32) (region->base + offset));
+	flash_lock();
+
+	if (!flash_is_erased(region, offset, region->page_size)) {
+		return E_SPECTRUM_IO;
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+static int flash_stm32_program(const struct flash_region* region, int offset,
+		const void* data, int len)
+{
+	int r = flash_check_program(region, offset, len);
+	if (r) return r;
+
+	uint8_t* p = region->base + offset;
+	const uint8_t* d = data;
+
+	flash_unlock();
+
+	int n;
+	for(n = 0; n < len; n += 2) {
+		u16 halfword = d[n] | (d[n+1] << 8);
+		flash_program_half_word((u32) (p + n), halfword);
+	}
+
+	flash_lock();
+
+	if (memcmp(p, d, len)) {
+		return E_SPECTRUM_IO;
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+const struct flash_region flash_log_region = {
+	.base		= (uint8_t*) FLASH_LOG_BASE,
+	.page_size	= FLASH_PAGE_SIZE,
+	.page_num	= FLASH_LOG_PAGE_NUM,
+	.erase_page	= flash_stm32_erase_page,
+	.program	= flash_stm32_program
+};
+
+const struct flash_region flash_settings_region = {
+	.base		= (uint8_t*) FLASH_SETTINGS_BASE,
+	.page_size	= FLASH_PAGE_SIZE,
+	.page_num	= 1,
+	.erase_page	= flash_stm32_erase_page,
+	.program	= flash_stm32_program
+};
+
+#endif
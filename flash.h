@@ -0,0 +1,74 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+#ifndef HAVE_FLASH_H
+#define HAVE_FLASH_H
+
+#include <stdint.h>
+
+struct flash_region;
+
+/* Erase page number page in region (set all bytes to 0xff).
+ *
+ * Return 0 on success, or error code otherwise. */
+typedef int (*flash_erase_page_t)(const struct flash_region* region, int page);
+
+/* Program len bytes from data at offset in region. Offset and len must be even
+ * and the target half-words must be erased.
+ *
+ * Return 0 on success, or error code otherwise. */
+typedef int (*flash_program_t)(const struct flash_region* region, int offset,
+		const void* data, int len);
+
+/* Region of flash memory reserved for application data.
+ *
+ * Contents are read directly through the base pointer. Writes must go through
+ * erase_page and program, which follow the STM32F1 rules: erased flash reads as
+ * 0xff, data is programmed in half-words and a half-word can only be programmed
+ * once after an erase. */
+struct flash_region {
+	/* Start of the region in memory */
+	uint8_t* base;
+
+	/* Size of an erase page in bytes */
+	int page_size;
+
+	/* Number of pages in the region */
+	int page_num;
+
+	flash_erase_page_t erase_page;
+	flash_program_t program;
+};
+
+/* Size of a flash page on high-density STM32F1 devices */
+#define FLASH_PAGE_SIZE		2048
+
+/* Number of pages at the end of the internal flash reserved for the sweep log
+ * (see vesna.ld). The last reserved page holds saved settings. With FLASH_RAM
+ * a smaller RAM-backed stand-in is used for the log. */
+#ifdef FLASH_RAM
+#  define FLASH_LOG_PAGE_NUM	4
+#else
+#  define FLASH_LOG_PAGE_NUM	31
+#endif
+
+extern const struct flash_region flash_log_region;
+extern const struct flash_region flash_settings_region;
+
+int flash_is_erased(const struct flash_region* region, int offset, int len);
+
+#endif
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <string.h>
 #include <libopencm3/stm32/f1/rcc.h>
 #include <libopencm3/stm32/f1/gpio.h>
@@ -28,6 +29,10 @@
 #include <libopencm3/stm32/nvic.h>
 
 #include "spectrum.h"
+#include "stats.h"
+#include "noise-floor.h"
+#include "flash-log.h"
+#include "settings.h"
 #include "dev-dummy.h"
 #include "dev-tda18219.h"
 #include "dev-cc.h"
@@ -39,9 +44,54 @@ static int usart_buffer_len = 0;
 static volatile int usart_buffer_attn = 0;
 static int report = 0;
 
+enum report_mode {
+	REPORT_SWEEP,
+	REPORT_ZOOM,
+	REPORT_SCHEDULE,
+	REPORT_STATS,
+	REPORT_EVENTS,
+	REPORT_OCCUPANCY,
+	REPORT_ZERO_SPAN
+};
+
+static enum report_mode report_mode = REPORT_SWEEP;
+
 static struct spectrum_sweep_config sweep_config;
+static struct spectrum_zoom_config zoom_config;
+static struct spectrum_schedule_config schedule_config;
+static struct spectrum_occupancy_config occupancy_config;
+static struct spectrum_zero_span_config zero_span_config;
+static struct stats stats;
+
+/* Noise floor percentile and adaptation step in 0.01 dB */
+#define NOISE_FLOOR_PERCENTILE	10
+#define NOISE_FLOOR_STEP	10
+
+static struct noise_floor noise_floor;
+
+/* Sweeps are also appended to the flash log when record is set */
+static struct flash_log flash_log;
+static int record = 0;
+
+/* Set at the start of each run, so that a session marker is stored before its
+ * first recorded sweep */
+static int record_session = 0;
+static int record_session_flags = FLASH_LOG_SESSION_BOOT;
+
+/* Number of sweeps that could not be stored in the flash log */
+static int record_error_num = 0;
+
+/* Current settings, as saved by the config-save command */
+static struct settings settings = { .dev_id = -1 };
+
+static struct spectrum_point* event_list = NULL;
+static int event_above;
 static const struct spectrum_dev* dev = NULL;
 
+/* Measured timing for each device configuration, NULL for devices that have
+ * not been benchmarked */
+static struct spectrum_bench_result* bench_list[SPECTRUM_MAX_DEV];
+
 extern void (*const vector_table[]) (void);
 
 /* Set up all the peripherals */
@@ -137,10 +187,45 @@ int _write(int file, char *ptr, int len)
 	}
 }
 
+static void update_noise_floor(const short int data_list[])
+{
+	if(noise_floor.est != NULL) {
+		noise_floor_update(&noise_floor, data_list);
+	}
+}
+
+static int record_sweep(const struct spectrum_sweep_config* sweep_config, int timestamp,
+		const short int data_list[])
+{
+	if (record_session) {
+		int r = flash_log_append_session(&flash_log, record_session_flags);
+		if (r) return r;
+
+		record_session = 0;
+		record_session_flags = 0;
+	}
+
+	return flash_log_append_sweep(&flash_log, settings.dev_id, settings.config_id,
+			sweep_config, timestamp, data_list);
+}
+
 static int report_cb(const struct spectrum_sweep_config* sweep_config, int timestamp, const short int data_list[])
 {
 	int channel_num = spectrum_sweep_channel_num(sweep_config);
 	int n;
+
+	update_noise_floor(data_list);
+
+	/* a failed write only loses this sweep, so keep recording. Errors are
+	 * counted for log-dump, since no host may be attached. */
+	if (record) {
+		int r = record_sweep(sweep_config, timestamp, data_list);
+		if (r) {
+			record_error_num++;
+			printf("error: flash_log_append_sweep(): %d\n", r);
+		}
+	}
+
 	printf("TS %d.%03d DS", timestamp/1000, timestamp%1000);
 	for(n = 0; n < channel_num; n++) {
 		printf(" %d.%02d", data_list[n]/100, abs(data_list[n]%100));
@@ -154,6 +239,93 @@ static int report_cb(const struct spectrum_sweep_config* sweep_config, int times
 	}
 }
 
+static int report_sparse_cb(const struct spectrum_sweep_config* sweep_config __attribute__((unused)),
+		int timestamp, const struct spectrum_point point_list[], int point_num)
+{
+	int n;
+	printf("TS %d.%03d PS", timestamp/1000, timestamp%1000);
+	for(n = 0; n < point_num; n++) {
+		printf(" %d %d.%02d", point_list[n].channel, 
+				point_list[n].data/100, abs(point_list[n].data%100));
+	}
+	printf(" PE\n");
+
+	if(usart_buffer_attn) {
+		return E_SPECTRUM_STOP_SWEEP;
+	} else {
+		return E_SPECTRUM_OK;
+	}
+}
+
+static int stats_cb(const struct spectrum_sweep_config* sweep_config __attribute__((unused)), 
+		int timestamp __attribute__((unused)), const short int data_list[])
+{
+	update_noise_floor(data_list);
+	stats_update(&stats, data_list);
+
+	if(usart_buffer_attn) {
+		return E_SPECTRUM_STOP_SWEEP;
+	} else {
+		return E_SPECTRUM_OK;
+	}
+}
+
+static int events_cb(const struct spectrum_sweep_config* sweep_config, int timestamp, const short int data_list[])
+{
+	int channel_num = spectrum_sweep_channel_num(sweep_config);
+	int n, event_num = 0;
+
+	update_noise_floor(data_list);
+
+	for(n = 0; n < channel_num; n++) {
+		if(data_list[n] > noise_floor_get(&noise_floor, n) + event_above) {
+			event_list[event_num].channel = sweep_config->channel_start + 
+				n * sweep_config->channel_step;
+			event_list[event_num].data = data_list[n];
+			event_num++;
+		}
+	}
+
+	if(event_num > 0) {
+		return report_sparse_cb(sweep_config, timestamp, event_list, event_num);
+	} else if(usart_buffer_attn) {
+		return E_SPECTRUM_STOP_SWEEP;
+	} else {
+		return E_SPECTRUM_OK;
+	}
+}
+
+static int report_occupancy_cb(const struct spectrum_sweep_config* sweep_config, int timestamp,
+		const unsigned char occupancy[])
+{
+	int channel_num = spectrum_sweep_channel_num(sweep_config);
+
+	printf("OS %d.%03d %d\n", timestamp/1000, timestamp%1000, channel_num);
+	fwrite(occupancy, 1, (channel_num + 7) / 8, stdout);
+	printf("OE\n");
+
+	if(usart_buffer_attn) {
+		return E_SPECTRUM_STOP_SWEEP;
+	} else {
+		return E_SPECTRUM_OK;
+	}
+}
+
+static int report_block_cb(const struct spectrum_zero_span_config* zero_span_config,
+		unsigned long long int timestamp_us, const short int data_list[])
+{
+	printf("ZS %llu %d %d\n", timestamp_us, zero_span_config->interval_us, 
+			zero_span_config->block_len);
+	fwrite(data_list, sizeof(*data_list), zero_span_config->block_len, stdout);
+	printf("ZE\n");
+
+	if(usart_buffer_attn) {
+		return E_SPECTRUM_STOP_SWEEP;
+	} else {
+		return E_SPECTRUM_OK;
+	}
+}
+
 static void command_help(void)
 {
 	printf( "VESNA spectrum sensing application\n\n"
@@ -162,15 +334,93 @@ static void command_help(void)
 		"list         list available devices and pre-set configuations\n"
 		"report-on    start spectrum sweep\n"
 		"report-off   stop spectrum sweep\n"
+		"keep-warm-on keep the device powered on and configured between\n"
+		"             sweeps for faster report-on\n"
+		"keep-warm-off\n"
+		"             put the device into standby after each sweep (default)\n"
 		"select channel START:STEP:STOP config DEVICE,CONFIG\n"
 		"             sweep channels from START to STOP stepping STEP\n"
 		"             channels at a time using DEVICE and CONFIG pre-set\n"
+		"select zoom STEP:WINDOW threshold POWER peaks NUM\n"
+		"             sweep selected channels, then sweep channels STEP\n"
+		"             at a time within WINDOW channels around up to NUM\n"
+		"             channels with power above POWER dBm\n"
+		"select schedule revisit NUM\n"
+		"             measure selected channels one at a time, more active\n"
+		"             channels more often, each channel at least once every\n"
+		"             NUM measurements\n"
+		"select stats MIN:WIDTH:MAX threshold POWER\n"
+		"             sweep selected channels and count power in WIDTH dB\n"
+		"             wide bins from MIN to MAX dBm and time above POWER dBm\n"
+		"             (at most 1000 bins per channel and 8192 in total)\n"
+		"stats-dump   print out statistics\n"
+		"select events above POWER\n"
+		"             sweep selected channels and report only channels with\n"
+		"             power more than POWER dB above noise floor\n"
+		"floor-dump   print out noise floor estimate for selected channels\n"
+		"select occupancy threshold POWER\n"
+		"             sweep selected channels and only report whether a\n"
+		"             carrier is present. POWER is the device specific carrier\n"
+		"             sense threshold in dB (-7 to 7 relative to AGC target\n"
+		"             on CC devices)\n"
+		"select zero-span channel CHANNEL interval TIME block NUM\n"
+		"             sample power on CHANNEL every TIME microseconds\n"
+		"             and report NUM samples at a time (at most 4096\n"
+		"             samples and 1 s per block). Fails if the device\n"
+		"             can't take a sample within TIME\n"
+		"bench        measure setup time and time per channel for all\n"
+		"             pre-set configurations and show them in list\n"
+		"record-on    also store sweeps in the flash log (sweep mode only)\n"
+		"record-off   stop storing sweeps in the flash log (default)\n"
+		"log-dump     print out all sweeps stored in the flash log\n"
+		"log-erase    remove all sweeps from the flash log\n"
+		"config-save [autostart]\n"
+		"             save selected channels, report mode, keep-warm and\n"
+		"             record settings to flash and restore them at boot. With\n"
+		"             autostart, also start the sweep at boot\n"
+		"config-clear don't restore any settings at boot\n"
 		"status       print out hardware status\n\n"
 
 		"sweep data has the following format:\n"
 		"             TS timestamp DS power ... DE\n"
 		"where timestamp is time in seconds since sweep start and power is\n"
-		"received signal power for corresponding channel in dBm\n");
+		"received signal power for corresponding channel in dBm\n\n"
+
+		"zoom, schedule and event data has the following format:\n"
+		"             TS timestamp PS channel power ... PE\n\n"
+
+		"occupancy data has the following format:\n"
+		"             OS timestamp num\n"
+		"             <binary data>\n"
+		"             OE\n"
+		"where binary data is one bit per channel for num channels, packed\n"
+		"into bytes starting with the least significant bit\n\n"
+
+		"zero-span data has the following format:\n"
+		"             ZS timestamp interval num\n"
+		"             <binary data>\n"
+		"             ZE\n"
+		"where timestamp is time of the first sample in microseconds, interval\n"
+		"is time between samples in microseconds and binary data are num\n"
+		"16-bit little-endian signed samples in 0.01 dBm\n\n"
+
+		"noise floor estimate has the following format:\n"
+		"             FS power ... FE\n\n"
+
+		"flash log dump has the following format:\n"
+		"             LS frames NUM bytes NUM erases NUM errors NUM\n"
+		"             <binary data>\n"
+		"             LE\n"
+		"where binary data are frames, each a 16-bit little-endian length\n"
+		"followed by a compressed sweep of that length (see flash-log.h), and\n"
+		"erases is the largest erase count of a flash page\n\n"
+
+		"statistics have the following format:\n"
+		"             SS sweeps NUM min POWER width POWER bins NUM\n"
+		"             CH channel above count ...\n"
+		"             SE\n"
+		"where above is the number of measurements above the threshold and\n"
+		"count is the number of measurements in each bin\n");
 }
 
 static void command_list(void)
@@ -189,6 +439,11 @@ static void command_list(void)
 			printf("    bw: %d Hz\n", dev_config->channel_bw_hz);
 			printf("    num: %d\n", dev_config->channel_num);
 			printf("    time: %d ms\n", dev_config->channel_time_ms);
+			if (bench_list[dev_id] != NULL) {
+				const struct spectrum_bench_result* result = &bench_list[dev_id][config_id];
+				printf("    measured: %lu us\n", (unsigned long) result->channel_us);
+				printf("    setup: %lu us\n", (unsigned long) result->setup_us);
+			}
 		}
 	}
 }
@@ -208,20 +463,79 @@ static void command_report_off(void)
 	printf("ok\n");
 }
 
-static void command_select(int start, int step, int stop, int dev_id, int config_id) 
+/* Message for the last error returned by a function that applies a setting */
+static char error_msg[64];
+
+static int set_error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static int set_error(const char* format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vsnprintf(error_msg, sizeof(error_msg), format, ap);
+	va_end(ap);
+
+	return E_SPECTRUM_INVALID;
+}
+
+/* Print the response to a command that applied a setting and returned r */
+static void print_result(int r)
+{
+	if (r) {
+		printf("error: %s\n", error_msg);
+	} else {
+		printf("ok\n");
+	}
+}
+
+static void set_keep_warm(int keep_warm)
+{
+	spectrum_set_keep_warm(keep_warm);
+	settings.keep_warm = keep_warm;
+}
+
+static void command_keep_warm(int keep_warm)
+{
+	set_keep_warm(keep_warm);
+	printf("ok\n");
+}
+
+/* Remember arguments of the command that set the report mode */
+static void set_mode_settings(int arg0, int arg1, int arg2, int arg3)
+{
+	settings.report_mode = report_mode;
+	settings.mode_arg[0] = arg0;
+	settings.mode_arg[1] = arg1;
+	settings.mode_arg[2] = arg2;
+	settings.mode_arg[3] = arg3;
+}
+
+static int select_sweep(int start, int step, int stop, int dev_id, int config_id)
 {
 	if (dev_id < 0 || dev_id >= spectrum_dev_num) {
-		printf("error: unknown device %d\n", dev_id);
-		return;
+		return set_error("unknown device %d", dev_id);
 	}
 
-	dev = spectrum_dev_list[dev_id];
+	const struct spectrum_dev* new_dev = spectrum_dev_list[dev_id];
 
-	if (config_id < 0 || config_id >= dev->dev_config_num) {
-		printf("error: unknown config %d\n", config_id);
+	if (config_id < 0 || config_id >= new_dev->dev_config_num) {
+		return set_error("unknown config %d", config_id);
 	}
 
-	const struct spectrum_dev_config* dev_config = dev->dev_config_list[config_id];
+	const struct spectrum_dev_config* dev_config = new_dev->dev_config_list[config_id];
+
+	/* check everything before changing the current selection, so that a
+	 * rejected command (or saved setting) leaves it untouched */
+	if (step <= 0) {
+		return set_error("invalid step %d", step);
+	}
+
+	if (start < 0 || start >= stop || stop > dev_config->channel_num) {
+		return set_error("invalid channel range %d:%d", start, stop);
+	}
+
+	dev = new_dev;
 
 	sweep_config.dev_config = dev_config;
 	sweep_config.channel_start = start;
@@ -230,9 +544,473 @@ static void command_select(int start, int step, int stop, int dev_id, int config
 
 	sweep_config.cb = report_cb;
 
+	/* statistics are kept per channel and don't apply to the new selection */
+	stats_free(&stats);
+
+	free(event_list);
+	event_list = NULL;
+
+	/* noise floor is not tracked if there is not enough memory */
+	noise_floor_init(&noise_floor, spectrum_sweep_channel_num(&sweep_config),
+			NOISE_FLOOR_PERCENTILE, NOISE_FLOOR_STEP);
+
+	report_mode = REPORT_SWEEP;
+
+	settings.dev_id = dev_id;
+	settings.config_id = config_id;
+	settings.channel_start = start;
+	settings.channel_step = step;
+	settings.channel_stop = stop;
+	set_mode_settings(0, 0, 0, 0);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select(int start, int step, int stop, int dev_id, int config_id)
+{
+	print_result(select_sweep(start, step, stop, dev_id, config_id));
+}
+
+static int select_zoom(int step, int window, int threshold, int peak_num)
+{
+	if (dev == NULL) {
+		return set_error("set channel config first");
+	}
+
+	if (step <= 0 || window < 0) {
+		return set_error("invalid step or window");
+	}
+
+	if (peak_num <= 0 || peak_num > SPECTRUM_ZOOM_MAX_PEAKS) {
+		return set_error("number of peaks must be between 1 and %d", 
+				SPECTRUM_ZOOM_MAX_PEAKS);
+	}
+
+	zoom_config.fine_step = step;
+	zoom_config.fine_window = window;
+	zoom_config.threshold = threshold * 100;
+	zoom_config.peak_num = peak_num;
+
+	zoom_config.cb = report_sparse_cb;
+
+	report_mode = REPORT_ZOOM;
+	set_mode_settings(step, window, threshold, peak_num);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select_zoom(int step, int window, int threshold, int peak_num)
+{
+	print_result(select_zoom(step, window, threshold, peak_num));
+}
+
+static int select_schedule(int revisit_max)
+{
+	if (dev == NULL) {
+		return set_error("set channel config first");
+	}
+
+	if (revisit_max < spectrum_sweep_channel_num(&sweep_config)) {
+		return set_error("revisit interval must be at least %d",
+				spectrum_sweep_channel_num(&sweep_config));
+	}
+
+	schedule_config.revisit_max = revisit_max;
+	schedule_config.cb = report_sparse_cb;
+
+	report_mode = REPORT_SCHEDULE;
+	set_mode_settings(revisit_max, 0, 0, 0);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select_schedule(int revisit_max)
+{
+	print_result(select_schedule(revisit_max));
+}
+
+static int select_stats(int min, int width, int max, int threshold)
+{
+	if (dev == NULL) {
+		return set_error("set channel config first");
+	}
+
+	if (min < STATS_POWER_MIN/100 || max > STATS_POWER_MAX/100 ||
+			threshold < STATS_POWER_MIN/100 || threshold > STATS_POWER_MAX/100) {
+		return set_error("power must be between %d and %d dBm",
+				STATS_POWER_MIN/100, STATS_POWER_MAX/100);
+	}
+
+	if (width <= 0 || width > (STATS_POWER_MAX - STATS_POWER_MIN)/100 || max <= min) {
+		return set_error("invalid histogram range");
+	}
+
+	int channel_num = spectrum_sweep_channel_num(&sweep_config);
+	int bin_num = (max - min + width - 1) / width;
+
+	if (bin_num > STATS_BIN_MAX || channel_num > STATS_HIST_MAX / bin_num) {
+		return set_error("too many bins (at most %d per channel, %d in total)",
+				STATS_BIN_MAX, STATS_HIST_MAX);
+	}
+
+	struct stats_config stats_config = {
+		.channel_num	= channel_num,
+		.bin_min	= min * 100,
+		.bin_width	= width * 100,
+		.bin_num	= bin_num,
+		.threshold	= threshold * 100
+	};
+
+	int r = stats_init(&stats, &stats_config);
+	if (r) {
+		return set_error("stats_init(): %d", r);
+	}
+
+	sweep_config.cb = stats_cb;
+
+	report_mode = REPORT_STATS;
+	set_mode_settings(min, width, max, threshold);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select_stats(int min, int width, int max, int threshold)
+{
+	print_result(select_stats(min, width, max, threshold));
+}
+
+static void command_stats_dump(void)
+{
+	const struct stats_config* config = &stats.config;
+
+	if (stats.hist == NULL) {
+		printf("error: select stats first\n");
+		return;
+	}
+
+	printf("SS sweeps %lu min %d width %d bins %d\n",
+			(unsigned long) stats.sweep_num,
+			config->bin_min/100, config->bin_width/100, config->bin_num);
+
+	int m, n;
+	for(m = 0; m < config->channel_num; m++) {
+		printf("CH %d %lu", 
+				sweep_config.channel_start + m * sweep_config.channel_step,
+				(unsigned long) stats.above[m]);
+		for(n = 0; n < config->bin_num; n++) {
+			printf(" %u", stats.hist[m * config->bin_num + n]);
+		}
+		printf("\n");
+	}
+
+	printf("SE\n");
+}
+
+static int select_events(int above)
+{
+	if (dev == NULL) {
+		return set_error("set channel config first");
+	}
+
+	if (noise_floor.est == NULL) {
+		return set_error("not enough memory for noise floor estimate");
+	}
+
+	if (event_list == NULL) {
+		event_list = calloc(noise_floor.channel_num, sizeof(*event_list));
+		if (event_list == NULL) {
+			return set_error("not enough memory for events");
+		}
+	}
+
+	event_above = above * 100;
+
+	sweep_config.cb = events_cb;
+
+	report_mode = REPORT_EVENTS;
+	set_mode_settings(above, 0, 0, 0);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select_events(int above)
+{
+	print_result(select_events(above));
+}
+
+static int select_occupancy(int threshold)
+{
+	if (dev == NULL) {
+		return set_error("set channel config first");
+	}
+
+	if (dev->dev_occupancy_start == NULL) {
+		return set_error("occupancy sweep not supported by device");
+	}
+
+	occupancy_config.threshold = threshold;
+	occupancy_config.cb = report_occupancy_cb;
+
+	report_mode = REPORT_OCCUPANCY;
+	set_mode_settings(threshold, 0, 0, 0);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select_occupancy(int threshold)
+{
+	print_result(select_occupancy(threshold));
+}
+
+static int select_zero_span(int channel, int interval_us, int block_len)
+{
+	if (dev == NULL) {
+		return set_error("set channel config first");
+	}
+
+	if (dev->dev_zero_span_start == NULL) {
+		return set_error("zero-span not supported by device");
+	}
+
+	if (channel < 0 || channel >= sweep_config.dev_config->channel_num) {
+		return set_error("invalid channel %d", channel);
+	}
+
+	if (interval_us <= 0 || interval_us > SPECTRUM_ZERO_SPAN_MAX_INTERVAL_US ||
+			block_len <= 0 || block_len > SPECTRUM_ZERO_SPAN_MAX_BLOCK_LEN) {
+		return set_error("invalid interval or block length");
+	}
+
+	if ((long long int) block_len * interval_us > SPECTRUM_ZERO_SPAN_MAX_BLOCK_US) {
+		return set_error("block longer than %d us", SPECTRUM_ZERO_SPAN_MAX_BLOCK_US);
+	}
+
+	zero_span_config.dev_config = sweep_config.dev_config;
+	zero_span_config.channel = channel;
+	zero_span_config.interval_us = interval_us;
+	zero_span_config.block_len = block_len;
+	zero_span_config.cb = report_block_cb;
+
+	report_mode = REPORT_ZERO_SPAN;
+	set_mode_settings(channel, interval_us, block_len, 0);
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_select_zero_span(int channel, int interval_us, int block_len)
+{
+	print_result(select_zero_span(channel, interval_us, block_len));
+}
+
+static void command_floor_dump(void)
+{
+	if (noise_floor.est == NULL) {
+		printf("error: no noise floor estimate\n");
+		return;
+	}
+
+	int n;
+	printf("FS");
+	for(n = 0; n < noise_floor.channel_num; n++) {
+		short int floor = noise_floor_get(&noise_floor, n);
+		printf(" %d.%02d", floor/100, abs(floor%100));
+	}
+	printf(" FE\n");
+}
+
+/* Benchmark all configurations of all devices.
+ *
+ * Return 0 on success, or error code otherwise. */
+static int bench_all(void)
+{
+	int dev_id, config_id;
+	for(dev_id = 0; dev_id < spectrum_dev_num; dev_id++) {
+		const struct spectrum_dev* bench_dev = spectrum_dev_list[dev_id];
+
+		free(bench_list[dev_id]);
+		bench_list[dev_id] = calloc(bench_dev->dev_config_num, sizeof(**bench_list));
+		if (bench_list[dev_id] == NULL) {
+			return E_SPECTRUM_TOOMANY;
+		}
+
+		for(config_id = 0; config_id < bench_dev->dev_config_num; config_id++) {
+			int r = spectrum_bench(bench_dev, bench_dev->dev_config_list[config_id],
+					&bench_list[dev_id][config_id]);
+			if (r) {
+				free(bench_list[dev_id]);
+				bench_list[dev_id] = NULL;
+				return r;
+			}
+		}
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_bench(void)
+{
+	int r = bench_all();
+	if (r) {
+		printf("error: spectrum_bench(): %d\n", r);
+		return;
+	}
+
+	printf("ok\n");
+}
+
+static int set_record(int on)
+{
+	if (on && flash_log.region == NULL) {
+		return set_error("flash log not available");
+	}
+
+	record = on;
+	settings.record = on;
+
+	return E_SPECTRUM_OK;
+}
+
+static void command_record(int on)
+{
+	print_result(set_record(on));
+}
+
+struct log_dump_size {
+	int frame_num;
+	int byte_num;
+};
+
+static int log_dump_size_cb(void* priv, const uint8_t* data __attribute__((unused)), int len)
+{
+	struct log_dump_size* size = priv;
+
+	size->frame_num++;
+	size->byte_num += 2 + len;
+
+	return 0;
+}
+
+static int log_dump_cb(void* priv __attribute__((unused)), const uint8_t* data, int len)
+{
+	uint8_t len_data[2] = { len & 0xff, len >> 8 };
+
+	fwrite(len_data, 1, sizeof(len_data), stdout);
+	fwrite(data, 1, len, stdout);
+
+	IWDG_KR = IWDG_KR_RESET;
+
+	return 0;
+}
+
+static void command_log_dump(void)
+{
+	if (flash_log.region == NULL) {
+		printf("error: flash log not available\n");
+		return;
+	}
+
+	struct log_dump_size size = { 0, 0 };
+	flash_log_iterate(&flash_log, log_dump_size_cb, &size);
+
+	printf("LS frames %d bytes %d erases %lu errors %d\n", size.frame_num, size.byte_num,
+			(unsigned long) flash_log.erase_max, record_error_num);
+	flash_log_iterate(&flash_log, log_dump_cb, NULL);
+	printf("LE\n");
+}
+
+static void command_log_erase(void)
+{
+	if (flash_log.region == NULL) {
+		printf("error: flash log not available\n");
+		return;
+	}
+
+	int r = flash_log_erase(&flash_log);
+	if (r) {
+		printf("error: flash_log_erase(): %d\n", r);
+		return;
+	}
+
 	printf("ok\n");
 }
 
+static void command_config_save(int autostart)
+{
+	settings.autostart = autostart;
+
+	int r = settings_save(&flash_settings_region, &settings);
+	if (r) {
+		printf("error: settings_save(): %d\n", r);
+		return;
+	}
+
+	printf("ok\n");
+}
+
+static void command_config_clear(void)
+{
+	const struct settings empty = { .dev_id = -1 };
+
+	int r = settings_save(&flash_settings_region, &empty);
+	if (r) {
+		printf("error: settings_save(): %d\n", r);
+		return;
+	}
+
+	printf("ok\n");
+}
+
+/* Apply settings saved with config-save. Nothing is printed, so that a host
+ * doesn't receive responses to commands it didn't send. */
+static void restore_settings(void)
+{
+	struct settings saved;
+
+	if (settings_load(&flash_settings_region, &saved) || saved.dev_id < 0) {
+		return;
+	}
+
+	const int32_t* arg = saved.mode_arg;
+
+	/* saved selection is checked like a command and ignored if invalid */
+	int r = select_sweep(saved.channel_start, saved.channel_step, saved.channel_stop,
+			saved.dev_id, saved.config_id);
+	if (r) return;
+
+	switch(saved.report_mode) {
+		case REPORT_ZOOM:
+			r = select_zoom(arg[0], arg[1], arg[2], arg[3]);
+			break;
+		case REPORT_SCHEDULE:
+			r = select_schedule(arg[0]);
+			break;
+		case REPORT_STATS:
+			r = select_stats(arg[0], arg[1], arg[2], arg[3]);
+			break;
+		case REPORT_EVENTS:
+			r = select_events(arg[0]);
+			break;
+		case REPORT_OCCUPANCY:
+			r = select_occupancy(arg[0]);
+			break;
+		case REPORT_ZERO_SPAN:
+			r = select_zero_span(arg[0], arg[1], arg[2]);
+			break;
+		default:
+			break;
+	}
+
+	set_keep_warm(saved.keep_warm);
+	if (saved.record) {
+		set_record(1);
+	}
+
+	/* don't start in a different mode than the one saved */
+	if (saved.autostart && !r) {
+		report = 1;
+	}
+}
+
 static void command_version(void)
 {
 	printf("%s\n", VERSION);
@@ -258,6 +1036,8 @@ static void command_status(void)
 static void dispatch(const char* cmd)
 {
 	int start, stop, step, dev_id, config_id;
+	int window, threshold, peak_num, revisit_max, min, width, max, above;
+	int channel, interval_us, block_len;
 
 	if (!strcmp(cmd, "help")) {
 		command_help();
@@ -267,12 +1047,51 @@ static void dispatch(const char* cmd)
 		command_report_on();
 	} else if (!strcmp(cmd, "report-off")) {
 		command_report_off();
+	} else if (!strcmp(cmd, "keep-warm-on")) {
+		command_keep_warm(1);
+	} else if (!strcmp(cmd, "keep-warm-off")) {
+		command_keep_warm(0);
+	} else if (!strcmp(cmd, "bench")) {
+		command_bench();
 	} else if (!strcmp(cmd, "status")) {
 		command_status();
+	} else if (!strcmp(cmd, "record-on")) {
+		command_record(1);
+	} else if (!strcmp(cmd, "record-off")) {
+		command_record(0);
+	} else if (!strcmp(cmd, "log-dump")) {
+		command_log_dump();
+	} else if (!strcmp(cmd, "log-erase")) {
+		command_log_erase();
+	} else if (!strcmp(cmd, "config-save")) {
+		command_config_save(0);
+	} else if (!strcmp(cmd, "config-save autostart")) {
+		command_config_save(1);
+	} else if (!strcmp(cmd, "config-clear")) {
+		command_config_clear();
 	} else if (sscanf(cmd, "select channel %d:%d:%d config %d,%d", 
 				&start, &step, &stop,
 				&dev_id, &config_id) == 5) {
 		command_select(start, step, stop, dev_id, config_id);
+	} else if (sscanf(cmd, "select zoom %d:%d threshold %d peaks %d",
+				&step, &window, &threshold, &peak_num) == 4) {
+		command_select_zoom(step, window, threshold, peak_num);
+	} else if (sscanf(cmd, "select schedule revisit %d", &revisit_max) == 1) {
+		command_select_schedule(revisit_max);
+	} else if (sscanf(cmd, "select stats %d:%d:%d threshold %d",
+				&min, &width, &max, &threshold) == 4) {
+		command_select_stats(min, width, max, threshold);
+	} else if (!strcmp(cmd, "stats-dump")) {
+		command_stats_dump();
+	} else if (sscanf(cmd, "select events above %d", &above) == 1) {
+		command_select_events(above);
+	} else if (!strcmp(cmd, "floor-dump")) {
+		command_floor_dump();
+	} else if (sscanf(cmd, "select occupancy threshold %d", &threshold) == 1) {
+		command_select_occupancy(threshold);
+	} else if (sscanf(cmd, "select zero-span channel %d interval %d block %d",
+				&channel, &interval_us, &block_len) == 3) {
+		command_select_zero_span(channel, interval_us, block_len);
 	} else if (!strcmp(cmd, "version")) {
 		command_version();
 	} else {
@@ -280,6 +1099,22 @@ static void dispatch(const char* cmd)
 	}
 }
 
+static int run(void)
+{
+	switch(report_mode) {
+		case REPORT_ZOOM:
+			return spectrum_run_zoom(dev, &sweep_config, &zoom_config);
+		case REPORT_SCHEDULE:
+			return spectrum_run_schedule(dev, &sweep_config, &schedule_config);
+		case REPORT_OCCUPANCY:
+			return spectrum_run_occupancy(dev, &sweep_config, &occupancy_config);
+		case REPORT_ZERO_SPAN:
+			return spectrum_run_zero_span(dev, &zero_span_config);
+		default:
+			return spectrum_run(dev, &sweep_config);
+	}
+}
+
 int main(void)
 {
 	setup();
@@ -303,6 +1138,21 @@ int main(void)
 		printf("spectrum_reset(): error %d\n", r);
 	}
 
+	r = flash_log_init(&flash_log, &flash_log_region);
+	if (r) {
+		printf("flash_log_init(): error %d\n", r);
+		flash_log.region = NULL;
+	}
+
+#ifdef BENCH_AT_BOOT
+	r = bench_all();
+	if (r) {
+		printf("spectrum_bench(): error %d\n", r);
+	}
+#endif
+
+	restore_settings();
+
 	while (1) {
 		if (usart_buffer_attn) {
 			dispatch(usart_buffer);
@@ -310,7 +1160,9 @@ int main(void)
 		}
 		IWDG_KR = IWDG_KR_RESET;
 		if (report) {
-			r = spectrum_run(dev, &sweep_config);
+			/* timestamps restart with each run */
+			record_session = 1;
+			r = run();
 			if (r) {
 				printf("error: spectrum_run(): %d\n", r);
 			}
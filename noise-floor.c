@@ -0,0 +1,91 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+
+/* Per-channel noise floor tracking */
+
+#include <stdlib.h>
+#include "spectrum.h"
+#include "noise-floor.h"
+
+/* Allocate and clear noise floor estimates.
+ *
+ * Return 0 on success, or error code otherwise. */
+int noise_floor_init(struct noise_floor* nf, int channel_num, int percentile, int step)
+{
+	noise_floor_free(nf);
+
+	if (channel_num <= 0 || percentile <= 0 || percentile >= 100 || step <= 0) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	nf->est = calloc(channel_num, sizeof(*nf->est));
+	nf->n = calloc(channel_num, sizeof(*nf->n));
+
+	if (nf->est == NULL || nf->n == NULL) {
+		noise_floor_free(nf);
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	nf->channel_num = channel_num;
+	nf->percentile = percentile;
+	nf->step = step;
+
+	return E_SPECTRUM_OK;
+}
+
+void noise_floor_free(struct noise_floor* nf)
+{
+	free(nf->est);
+	free(nf->n);
+
+	nf->est = NULL;
+	nf->n = NULL;
+	nf->channel_num = 0;
+}
+
+/* Add a measurement for channel m. */
+void noise_floor_update_channel(struct noise_floor* nf, int m, short int data)
+{
+	int32_t x = ((int32_t) data) * 100;
+
+	if (nf->n[m] < NOISE_FLOOR_WARMUP) {
+		if (nf->n[m] == 0 || x < nf->est[m]) {
+			nf->est[m] = x;
+		}
+		nf->n[m]++;
+	} else if (x < nf->est[m]) {
+		nf->est[m] -= nf->step * (100 - nf->percentile);
+	} else {
+		nf->est[m] += nf->step * nf->percentile;
+	}
+}
+
+/* Add measurements from one sweep. */
+void noise_floor_update(struct noise_floor* nf, const short int data_list[])
+{
+	int m;
+	for(m = 0; m < nf->channel_num; m++) {
+		noise_floor_update_channel(nf, m, data_list[m]);
+	}
+}
+
+/* Return noise floor estimate for channel m in 0.01 dBm. */
+short int noise_floor_get(const struct noise_floor* nf, int m)
+{
+	return nf->est[m] / 100;
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+#ifndef HAVE_NOISE_FLOOR_H
+#define HAVE_NOISE_FLOOR_H
+
+#include <stdint.h>
+
+/* Streaming per-channel noise floor estimate.
+ *
+ * The noise floor is estimated as a low percentile of measured power on each
+ * channel. After a short warm-up, where the estimate is the minimum of
+ * measurements, each new measurement P moves the estimate E by
+ *
+ * E = E - step * (100 - percentile) / 100    if P < E
+ * E = E + step * percentile / 100            otherwise
+ *
+ * which converges to the given percentile of the power distribution. */
+struct noise_floor {
+	/* Number of channels */
+	int channel_num;
+
+	/* Percentile of power distribution to track */
+	int percentile;
+
+	/* Adaptation step in 0.01 dB */
+	int step;
+
+	/* est[m] = estimate for channel m in 0.0001 dBm */
+	int32_t* est;
+
+	/* n[m] = number of measurements on channel m during warm-up */
+	uint8_t* n;
+};
+
+#define NOISE_FLOOR_WARMUP 16
+
+int noise_floor_init(struct noise_floor* nf, int channel_num, int percentile, int step);
+void noise_floor_free(struct noise_floor* nf);
+void noise_floor_update_channel(struct noise_floor* nf, int m, short int data);
+void noise_floor_update(struct noise_floor* nf, const short int data_list[]);
+short int noise_floor_get(const struct noise_floor* nf, int m);
+
+#endif
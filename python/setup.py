@@ -1,6 +1,8 @@
 #!/usr/bin/python
 
-from distutils.core import Command, setup
+from distutils.command.build_ext import build_ext
+from distutils.core import Command, Extension, setup
+from distutils.errors import CCompilerError, DistutilsExecError, DistutilsPlatformError
 import unittest
 
 UNITTESTS = [
@@ -25,6 +27,24 @@ class TestCommand(Command):
 
 		result = unittest.TextTestRunner(verbosity=2).run(suite)
 
+class OptionalBuildExt(build_ext):
+	"""Build C extensions, but continue without them if compilation fails.
+
+	Pure Python implementation in vesna.sweepparser is used instead of
+	vesna._sweepparser in that case."""
+
+	def run(self):
+		try:
+			build_ext.run(self)
+		except DistutilsPlatformError, e:
+			print "warning: not building C extensions: %s" % (e,)
+
+	def build_extension(self, ext):
+		try:
+			build_ext.build_extension(self, ext)
+		except (CCompilerError, DistutilsExecError, DistutilsPlatformError), e:
+			print "warning: not building %s: %s" % (ext.name, e)
+
 setup(name='vesna-spectrumsensor',
       version='0.1',
       description='Tools for talking the VESNA almost-like-HTTP protocol',
@@ -36,8 +56,11 @@ setup(name='vesna-spectrumsensor',
       packages = [ 'vesna', 'vesna.rftest' ],
       provides = [ 'vesna', 'vesna.rftest' ],
 
-      scripts = [ 'scripts/vesna_rftest' ],
+      scripts = [ 'scripts/vesna_rftest', 'scripts/vesna_sensord',
+		'scripts/vesna_fakesensor' ],
+
+      ext_modules = [ Extension('vesna._sweepparser', [ 'vesna/_sweepparser.c' ]) ],
 
-      cmdclass = { 'test': TestCommand }
+      cmdclass = { 'test': TestCommand, 'build_ext': OptionalBuildExt }
 
 )
@@ -1,6 +1,46 @@
+import array
+import multiprocessing
+import os
+import shutil
+import struct
+import tempfile
+import time
 import unittest
 
-from vesna.spectrumsensor import Device, DeviceConfig, SweepConfig, DeviceConfig, ConfigList
+from vesna.spectrumsensor import Device, DeviceConfig, SweepConfig, DeviceConfig, ConfigList, \
+		SpectrumSensor, SpectrumSensorException, Sweep, parse_log_dump
+from vesna.multisensor import MultiSpectrumSensor
+from vesna import sweepparser
+from vesna.sweepstream import SweepStream
+from vesna.daemon import SweepRing, SpectrumSensorDaemon, DaemonClient
+from vesna.recording import RecordingWriter, Recording, ReplaySource
+from vesna.fakesensor import FakeSensor
+from vesna.rftest import DeviceUnderTest, FakeSignalGenerator, MeasurementStep, \
+		PipelinedExecutor, SharedSignalGenerator, GeneratorCoordinator, group_channels
+
+def make_config(id=0, device=None, name="test", base=1000, spacing=1, bw=1, num=100, time=1,
+		setup=None):
+	"""Return a device configuration with the given parameters."""
+	if device is None:
+		device = Device(0, "test")
+
+	dc = DeviceConfig(id, name, device)
+	dc.base = base
+	dc.spacing = spacing
+	dc.bw = bw
+	dc.num = num
+	dc.time = time
+	dc.setup = setup
+	return dc
+
+def make_config_list(*configs):
+	"""Return a configuration list containing the given configurations and their devices."""
+	cl = ConfigList()
+	for dc in configs:
+		if dc.device not in cl.devices:
+			cl._add_device(dc.device)
+		cl._add_config(dc)
+	return cl
 
 class TestDeviceConfig(unittest.TestCase):
 	def setUp(self):
@@ -81,3 +121,989 @@ class TestConfigList(unittest.TestCase):
 
 		sc = cl.get_sweep_config(2500, 2600, 1, name="bar")
 		self.assertEquals(3, sc.config.id)
+
+class TestSweepPlan(unittest.TestCase):
+	def setUp(self):
+		self.cl = ConfigList()
+
+		self.d0 = Device(0, "test 0")
+		self.cl._add_device(self.d0)
+		self.d1 = Device(1, "test 1")
+		self.cl._add_device(self.d1)
+
+	def add_dc(self, d, id, base, num, time, bw=1, setup=None, spacing=1):
+		dc = make_config(id, d, base=base, spacing=spacing, bw=bw, num=num, time=time,
+				setup=setup)
+		self.cl._add_config(dc)
+		return dc
+
+	def test_get_sweep_config_fastest(self):
+		self.add_dc(self.d0, 0, 1000, 1000, 5)
+		self.add_dc(self.d0, 1, 1000, 1000, 1)
+
+		sc = self.cl.get_sweep_config(1500, 1600, 1)
+		self.assertEquals(1, sc.config.id)
+
+	def test_single(self):
+		self.add_dc(self.d0, 0, 1000, 1000, 5)
+		dc = self.add_dc(self.d0, 1, 1000, 1000, 1)
+
+		p = self.cl.get_sweep_plan(1500, 1599, 1)
+		self.assertEquals(len(p.segments), 1)
+		self.assertEquals(p.segments[0].config, dc)
+		self.assertEquals(p.cost_us, 100 * 1000)
+		self.assertEquals(p.get_hz_list(), range(1500, 1600))
+
+	def test_setup_cost(self):
+		# faster per channel, but setup does not pay off for a narrow band
+		self.add_dc(self.d0, 0, 1000, 1000, 2)
+		self.add_dc(self.d0, 1, 1000, 1000, 1, setup=50000)
+
+		p = self.cl.get_sweep_plan(1500, 1509, 1)
+		self.assertEquals(p.segments[0].config.id, 0)
+
+		p = self.cl.get_sweep_plan(1000, 1999, 1)
+		self.assertEquals(p.segments[0].config.id, 1)
+
+	def test_split(self):
+		slow = self.add_dc(self.d0, 0, 1000, 1000, 10)
+		fast_a = self.add_dc(self.d0, 1, 1000, 300, 1)
+		fast_b = self.add_dc(self.d1, 0, 1600, 400, 1)
+
+		p = self.cl.get_sweep_plan(1000, 1999, 1)
+		self.assertEquals([ sc.config for sc in p.segments ], [fast_a, slow, fast_b])
+		self.assertEquals(p.get_hz_list(), range(1000, 2000))
+		self.assertEquals(p.cost_us, (300 + 300*10 + 400) * 1000)
+
+	def test_step(self):
+		self.add_dc(self.d0, 0, 1000, 500, 1)
+		self.add_dc(self.d1, 0, 1500, 500, 1)
+
+		p = self.cl.get_sweep_plan(1000, 1999, 10)
+		self.assertEquals(len(p.segments), 2)
+		self.assertEquals(p.get_hz_list(), range(1000, 2000, 10))
+
+	def test_bw(self):
+		self.add_dc(self.d0, 0, 1000, 1000, 1, bw=100)
+
+		self.assertEquals(self.cl.get_sweep_plan(1000, 1999, 1, bw_hz=10), None)
+		self.assertNotEquals(self.cl.get_sweep_plan(1000, 1999, 1, bw_hz=100), None)
+
+	def test_gap(self):
+		self.add_dc(self.d0, 0, 1000, 100, 1)
+		self.add_dc(self.d0, 1, 1200, 100, 1)
+
+		self.assertEquals(self.cl.get_sweep_plan(1000, 1299, 1), None)
+
+	def test_grid(self):
+		self.add_dc(self.d0, 0, 1000, 100, 1, spacing=3)
+
+		# 1005 is not on the channel grid
+		self.assertEquals(self.cl.get_sweep_plan(1000, 1200, 5), None)
+		# 1001 is not on the channel grid
+		self.assertEquals(self.cl.get_sweep_plan(1001, 1200, 3), None)
+
+		p = self.cl.get_sweep_plan(1003, 1200, 6)
+		self.assertEquals(p.get_hz_list(), range(1003, 1201, 6))
+
+class MockComm:
+	def __init__(self, data):
+		self.data = data
+		self.written = []
+		self.timeout = 0.5
+
+	def write(self, data):
+		self.written.append(data)
+
+	def inWaiting(self):
+		# serial port returns data in small chunks
+		return min(len(self.data), 64)
+
+	def readline(self):
+		i = self.data.find("\n") + 1
+		if i == 0:
+			i = len(self.data)
+
+		line = self.data[:i]
+		self.data = self.data[i:]
+		return line
+
+	def read(self, size):
+		r = self.data[:size]
+		self.data = self.data[size:]
+		return r
+
+class MockSpectrumSensor(SpectrumSensor):
+	def __init__(self, data):
+		self.comm = MockComm(data)
+
+class TestLogDump(unittest.TestCase):
+	def setUp(self):
+		self.cl = make_config_list(make_config(1, name="test config", spacing=10))
+
+		# -100.0, -99.5, -100.0 dBm in units of 0.5 dB
+		frame = struct.pack("<BBBHIHHH", 1, 0, 1, 50, 1500, 10, 2, 3) + "\x8f\x03\x02\x01"
+		self.data = struct.pack("<H", len(frame)) + frame
+
+	def test_parse(self):
+		r = parse_log_dump(self.data * 2, self.cl)
+
+		self.assertEquals(len(r), 2)
+
+		sc, sweep = r[0]
+		self.assertEquals(sc.config.id, 1)
+		self.assertEquals(sc.get_ch_list(), [10, 12, 14])
+		self.assertEquals(sweep.timestamp, 1.5)
+		self.assertEquals(sweep.data, [-100.0, -99.5, -100.0])
+
+	def test_truncated(self):
+		self.assertRaises(ValueError, parse_log_dump, self.data[:-1], self.cl)
+
+	def test_split(self):
+		# rest of the sweep in the previous frame, -99.0 dBm on channel 16
+		frame = struct.pack("<BBBHIHHH", 1, 0, 1, 50, 1500, 16, 2, 1) + "\x8b\x03"
+		data = self.data + struct.pack("<H", len(frame)) + frame
+
+		r = parse_log_dump(data + self.data, self.cl)
+
+		self.assertEquals(len(r), 2)
+
+		sc, sweep = r[0]
+		self.assertEquals(sc.get_ch_list(), [10, 12, 14, 16])
+		self.assertEquals(sweep.data, [-100.0, -99.5, -100.0, -99.0])
+
+		sc, sweep = r[1]
+		self.assertEquals(sc.get_ch_list(), [10, 12, 14])
+
+	def test_session(self):
+		frame = struct.pack("<BBI", 2, 1, 7)
+		boot = struct.pack("<H", len(frame)) + frame
+		frame = struct.pack("<BBI", 2, 0, 8)
+		run = struct.pack("<H", len(frame)) + frame
+
+		r = parse_log_dump(self.data + boot + self.data + run + self.data, self.cl)
+
+		self.assertEquals([ (sweep.session, sweep.boot) for sc, sweep in r ],
+				[ (None, False), (7, True), (8, False) ])
+
+	def test_log_dump(self):
+		data = "LS frames 1 bytes %d erases 3 errors 0\n%sLE\n" % (len(self.data), self.data)
+		ss = MockSpectrumSensor(data)
+
+		r = ss.log_dump(self.cl)
+
+		self.assertEquals(ss.comm.written, ["log-dump\n"])
+		self.assertEquals(len(r), 1)
+		self.assertEquals(r[0][1].data, [-100.0, -99.5, -100.0])
+
+class TestSaveConfig(unittest.TestCase):
+	def test_save_config(self):
+		ss = MockSpectrumSensor("ok\nok\nok\n")
+
+		ss.save_config()
+		ss.save_config(autostart=True)
+		ss.clear_config()
+
+		self.assertEquals(ss.comm.written,
+				["config-save\n", "config-save autostart\n", "config-clear\n"])
+
+	def test_error(self):
+		ss = MockSpectrumSensor("error: settings_save(): -4\n")
+
+		self.assertRaises(SpectrumSensorException, ss.save_config)
+
+class TestConfigListBench(unittest.TestCase):
+	def test_get_config_list(self):
+		data =	"device 0: test\n" \
+			"  channel config 0,0: foo\n" \
+			"    base: 1000 Hz\n" \
+			"    spacing: 1 Hz\n" \
+			"    bw: 1 Hz\n" \
+			"    num: 100\n" \
+			"    time: 5 ms\n" \
+			"    measured: 2500 us\n" \
+			"    setup: 12000 us\n" \
+			"  channel config 0,1: bar\n" \
+			"    base: 1000 Hz\n" \
+			"    spacing: 1 Hz\n" \
+			"    bw: 1 Hz\n" \
+			"    num: 100\n" \
+			"    time: 5 ms\n"
+
+		ss = MockSpectrumSensor(data)
+		cl = ss.get_config_list()
+
+		dc = cl.get_config(0, 0)
+		self.assertEquals(dc.get_channel_time_us(), 2500)
+		self.assertEquals(dc.get_setup_time_us(), 12000)
+
+		dc = cl.get_config(0, 1)
+		self.assertEquals(dc.get_channel_time_us(), 5000)
+		self.assertEquals(dc.get_setup_time_us(), 0)
+
+class TestOccupancy(unittest.TestCase):
+	def setUp(self):
+		self.dc = make_config(num=1000)
+
+	def test_run_occupancy(self):
+		sc = SweepConfig(self.dc, 0, 10, 1)
+
+		data =	"ok\n" \
+			"ok\n" \
+			"OS 0.100 10\n" + "\x81\x02" + "OE\n" + \
+			"OS 0.200 10\n" + "\x81" + "OE\n" + \
+			"OS 0.300 10\n" + "\x00\x01" + "OE\n" + \
+			"ok\n"
+
+		ss = MockSpectrumSensor(data)
+
+		result = []
+		def cb(sweep_config, occupancy):
+			result.append(occupancy)
+			return len(result) < 2
+
+		ss.run_occupancy(sc, -3, cb)
+
+		self.assertEquals(ss.comm.written[1], "select occupancy threshold -3\n")
+
+		self.assertEquals(len(result), 2)
+		self.assertAlmostEquals(result[0].timestamp, 0.1)
+		self.assertEquals(result[0].data, [True] + [False]*6 + [True, False, True])
+		self.assertEquals(result[1].data, [False]*8 + [True, False])
+
+class TestZeroSpan(unittest.TestCase):
+	def setUp(self):
+		self.dc = make_config(num=1000)
+
+	def test_run_zero_span(self):
+		data =	"ok\n" \
+			"ok\n" \
+			"ZS 1000 50 3\n" + struct.pack("<3h", -10000, -5050, 0) + "ZE\n" + \
+			"ZS 2000 50 3\n" + struct.pack("<2h", 1, 2) + "ZE\n" + \
+			"ZS 3000 50 3\n" + struct.pack("<3h", 1, 2, 3) + "ZE\n" + \
+			"ok\n"
+
+		ss = MockSpectrumSensor(data)
+
+		blocks = []
+		def cb(config, block):
+			blocks.append(block)
+			return len(blocks) < 2
+
+		ss.run_zero_span(self.dc, 10, 50, 3, cb)
+
+		self.assertEquals(ss.comm.written[1], "select zero-span channel 10 interval 50 block 3\n")
+
+		self.assertEquals(len(blocks), 2)
+		self.assertAlmostEquals(blocks[0].timestamp, 1e-3)
+		self.assertAlmostEquals(blocks[0].interval, 50e-6)
+		self.assertEquals(blocks[0].data, [-100.0, -50.5, 0.0])
+		self.assertEquals(blocks[1].data, [.01, .02, .03])
+
+class TestSweepParser(unittest.TestCase):
+	def _test_parse(self, parse):
+		data =	"TS 0.100 DS -1.00 -2.50 DE\n" \
+			"ok\n" \
+			"TS 0.200 DS -3.00 DE\n" \
+			"TS 1.300 DS 0.50 -104.05 DE\r\n" \
+			"TS 1.400 DS -5.00 -6.00 DE\n" \
+			"TS 1.500 DS -7"
+
+		timestamps = array.array('d', [0.]) * 2
+		values = array.array('d', [0.]) * 4
+
+		num, end, num_corrupt = parse(data, 0, 2, timestamps, values)
+		self.assertEquals(num, 2)
+		self.assertEquals(num_corrupt, 2)
+		self.assertEquals(list(timestamps), [.1, 1.3])
+		self.assertEquals(list(values), [-1., -2.5, .5, -104.05])
+
+		num, end, num_corrupt = parse(data, end, 2, timestamps, values)
+		self.assertEquals(num, 1)
+		self.assertEquals(num_corrupt, 0)
+		self.assertEquals(timestamps[0], 1.4)
+		self.assertEquals(list(values[:2]), [-5., -6.])
+		self.assertEquals(data[end:], "TS 1.500 DS -7")
+
+	def _test_parse_invalid(self, parse):
+		valid = "TS 0.100 DS -1.00 DE\n"
+		invalid = [
+			"TS 0.100 DS  -1.00 DE\n",
+			"TS 0.100 DS -1.00 DE \n",
+			" TS 0.100 DS -1.00 DE\n",
+			"TS 0.100 DS -1e3 DE\n",
+			"TS 0.100 DS -1. DE\n",
+			"TS 0.100 DS .5 DE\n",
+			"TS 0.100 DS - DE\n",
+			"TS 0.100 DS --1.00 DE\n",
+			"TS 0.100 DS 1234567890.00 DE\n",
+			"TS 0.100 DS -1.0000000000 DE\n",
+			"TS 99999999999999999999999.100 DS -1.00 DE\n",
+		]
+
+		timestamps = array.array('d', [0.]) * len(invalid)
+		values = array.array('d', [0.]) * len(invalid)
+
+		data = "".join(invalid) + valid
+		num, end, num_corrupt = parse(data, 0, 1, timestamps, values)
+		self.assertEquals(num, 1)
+		self.assertEquals(num_corrupt, len(invalid))
+		self.assertEquals(end, len(data))
+		self.assertEquals(values[0], -1.)
+
+		data = "TS 123456789.123456789 DS -999999999.5 DE\n"
+		num, end, num_corrupt = parse(data, 0, 1, timestamps, values)
+		self.assertEquals(num, 1)
+		self.assertAlmostEquals(timestamps[0], 123456789.123456789)
+		self.assertEquals(values[0], -999999999.5)
+
+	def test_parse_c(self):
+		try:
+			from vesna import _sweepparser
+		except ImportError:
+			self.skipTest("compiled parser not available")
+
+		self._test_parse(_sweepparser.parse)
+		self._test_parse_invalid(_sweepparser.parse)
+
+	def test_parse_python(self):
+		self._test_parse(sweepparser._parse)
+		self._test_parse_invalid(sweepparser._parse)
+
+	def test_run_batch(self):
+		sc = SweepConfig(make_config(num=1000), 0, 2, 1)
+
+		data =	"ok\n" + \
+			"".join("TS %d.000 DS -%d.00 -1.00 DE\n" % (n, n) for n in xrange(5)) + \
+			"ok\n"
+
+		ss = MockSpectrumSensor(data)
+
+		sweeps = []
+		def cb(sweep_config, batch):
+			sweeps.extend(batch.get_sweeps())
+			return len(sweeps) < 3
+
+		ss.run_batch(sc, cb, max_sweeps=2)
+
+		self.assertEquals(len(sweeps), 4)
+		self.assertEquals([ sweep.timestamp for sweep in sweeps ], [0., 1., 2., 3.])
+		self.assertEquals(sweeps[3].data, [-3., -1.])
+
+class FakeRunSpectrumSensor(MockSpectrumSensor):
+	def __init__(self, num):
+		MockSpectrumSensor.__init__(self, "")
+		self.num = num
+
+	def run(self, sweep_config, cb):
+		for n in xrange(self.num):
+			sweep = Sweep()
+			sweep.timestamp = n
+			if not cb(sweep_config, sweep):
+				break
+
+class TestSweepStream(unittest.TestCase):
+	def test_drop_oldest(self):
+		ss = FakeRunSpectrumSensor(10)
+		stream = ss.stream(None, maxsize=3, policy=SweepStream.DROP_OLDEST)
+		stream._thread.join()
+
+		self.assertEquals([ sweep.timestamp for sweep in stream ], [8, 9])
+		self.assertEquals(stream.received, 10)
+		self.assertEquals(stream.dropped, 8)
+
+	def test_block(self):
+		ss = FakeRunSpectrumSensor(10)
+		stream = ss.stream(None, maxsize=3, policy=SweepStream.BLOCK)
+
+		self.assertEquals([ sweep.timestamp for sweep in stream ], range(10))
+		self.assertEquals(stream.dropped, 0)
+
+	def test_stop(self):
+		ss = FakeRunSpectrumSensor(1000)
+		stream = ss.stream(None, maxsize=1, policy=SweepStream.BLOCK)
+
+		sweeps = []
+		for sweep in stream:
+			sweeps.append(sweep)
+			if len(sweeps) == 5:
+				stream.stop()
+
+		self.assertTrue(len(sweeps) < 10)
+
+	def test_stop_abandoned(self):
+		ss = FakeRunSpectrumSensor(1000)
+		stream = ss.stream(None, maxsize=1, policy=SweepStream.BLOCK)
+
+		stream.get()
+		stream.stop()
+
+		# consumer doesn't read the rest of the queue
+		stream._thread.join(5)
+		self.assertFalse(stream._thread.is_alive())
+
+	def test_error(self):
+		class FailingSpectrumSensor(MockSpectrumSensor):
+			def run(self, sweep_config, cb):
+				raise IOError
+
+		stream = FailingSpectrumSensor("").stream(None)
+		self.assertRaises(IOError, stream.get)
+		self.assertEquals(stream.get(), None)
+
+class MockConfigSpectrumSensor(MockSpectrumSensor):
+	def __init__(self, data, id, base, num, time):
+		MockSpectrumSensor.__init__(self, data)
+
+		self.config_list = make_config_list(make_config(device=Device(0, "test %d" % (id,)),
+				base=base, num=num, time=time))
+
+	def get_config_list(self):
+		return self.config_list
+
+class TestMultiSpectrumSensor(unittest.TestCase):
+	def test_partition_equal(self):
+		ss = [ MockConfigSpectrumSensor("", n, 1000, 1000, 1) for n in xrange(2) ]
+		mss = MultiSpectrumSensor(ss)
+
+		p = mss.get_sweep_plan(1000, 1999, 1)
+		self.assertEquals(len(p.parts), 2)
+		self.assertEquals(p.get_hz_list(), range(1000, 2000))
+		self.assertEquals(p.cost_us, 500 * 1000)
+
+	def test_partition_speed(self):
+		ss = [	MockConfigSpectrumSensor("", 0, 1000, 1000, 3),
+			MockConfigSpectrumSensor("", 1, 1000, 1000, 1) ]
+		mss = MultiSpectrumSensor(ss)
+
+		p = mss.get_sweep_plan(1000, 1999, 1)
+		self.assertEquals(p.get_hz_list(), range(1000, 2000))
+
+		n = dict((sensor, plan.segments[0].num_channels) for sensor, plan in p.parts)
+		self.assertEquals(n[ss[0]], 250)
+		self.assertEquals(n[ss[1]], 750)
+
+	def test_partition_coverage(self):
+		ss = [	MockConfigSpectrumSensor("", 0, 1000, 100, 1),
+			MockConfigSpectrumSensor("", 1, 1100, 100, 1) ]
+		mss = MultiSpectrumSensor(ss)
+
+		p = mss.get_sweep_plan(1000, 1199, 1)
+		self.assertEquals([ sensor for sensor, plan in p.parts ], ss)
+
+		self.assertEquals(mss.get_sweep_plan(1000, 1299, 1), None)
+
+	def test_partition_unequal_coverage(self):
+		# slower sensor only covers the lower half of the band, but still
+		# speeds up the sweep
+		ss = [	MockConfigSpectrumSensor("", 0, 1000, 200, 1),
+			MockConfigSpectrumSensor("", 1, 1000, 100, 2) ]
+		mss = MultiSpectrumSensor(ss)
+
+		p = mss.get_sweep_plan(1000, 1199, 1)
+		self.assertEquals([ sensor for sensor, plan in p.parts ], [ss[1], ss[0]])
+		self.assertEquals(p.get_hz_list(), range(1000, 1200))
+		self.assertEquals(p.cost_us, 134 * 1000)
+
+	def test_run(self):
+		class FakeSpectrumSensor(MockConfigSpectrumSensor):
+			def __init__(self, sweeps, *args):
+				MockConfigSpectrumSensor.__init__(self, "", *args)
+				self.sweeps = sweeps
+
+			def run(self, sweep_config, cb):
+				for timestamp, data in self.sweeps:
+					sweep = Sweep()
+					sweep.timestamp = timestamp
+					sweep.data = data
+					if not cb(sweep_config, sweep):
+						break
+
+		ss = [	FakeSpectrumSensor([ (.1, [-1., -2.]), (.3, [-3., -4.]) ], 0, 1000, 2, 1),
+			FakeSpectrumSensor([ (.2, [-5., -6.]) ], 1, 1002, 2, 1) ]
+		mss = MultiSpectrumSensor(ss)
+
+		p = mss.get_sweep_plan(1000, 1003, 1)
+
+		sweeps = []
+		def cb(multi_plan, sweep):
+			sweeps.append(sweep)
+			return True
+
+		mss.run(p, cb)
+
+		self.assertEquals(len(sweeps), 1)
+		self.assertEquals(sweeps[0].data[2:], [-5., -6.])
+		self.assertTrue(sweeps[0].data[:2] in ([-1., -2.], [-3., -4.]))
+		self.assertTrue(sweeps[0].skew < .5)
+
+class TestSweepRing(unittest.TestCase):
+	def setUp(self):
+		self.dir = tempfile.mkdtemp()
+		self.path = os.path.join(self.dir, "ring")
+
+	def tearDown(self):
+		shutil.rmtree(self.dir)
+
+	def test_write_read(self):
+		writer = SweepRing(self.path, num_slots=4, max_channels=3)
+		reader = SweepRing(self.path)
+
+		self.assertEquals(reader.get_seq(), 0)
+		self.assertEquals(reader.read(1), None)
+
+		for n in xrange(6):
+			writer.write(n, [-n, -1., -2.][:n % 3 + 1])
+
+		self.assertEquals(reader.get_seq(), 6)
+
+		# overwritten
+		self.assertEquals(reader.read(2), None)
+
+		sweep = reader.read(5)
+		self.assertEquals(sweep.timestamp, 4)
+		self.assertEquals(list(sweep.data), [-4., -1.])
+
+		timestamp, buf = reader.get_view(6)
+		self.assertEquals(timestamp, 5)
+		self.assertEquals(list(array.array('d', str(buf))), [-5., -1., -2.])
+		self.assertTrue(reader.is_valid(6))
+
+		writer.write(6, [0.])
+		writer.write(7, [0.])
+		writer.write(8, [0.])
+		writer.write(9, [0.])
+		self.assertFalse(reader.is_valid(6))
+
+		self.assertEquals(reader.wait(11, timeout=.01), None)
+
+class SweepingSpectrumSensor(MockConfigSpectrumSensor):
+	def __init__(self):
+		MockConfigSpectrumSensor.__init__(self, "", 0, 1000, 100, 1)
+		self.fail_after = None
+
+	def run(self, sweep_config, cb):
+		n = 0
+		while True:
+			if n == self.fail_after:
+				raise IOError("device disconnected")
+
+			sweep = Sweep()
+			sweep.timestamp = n * .001
+			sweep.data = [ -float(ch) for ch in sweep_config.get_ch_list() ]
+			if not cb(sweep_config, sweep):
+				break
+			n += 1
+			time.sleep(.001)
+
+class TestSpectrumSensorDaemon(unittest.TestCase):
+	def setUp(self):
+		self.dir = tempfile.mkdtemp()
+		self.ring_path = os.path.join(self.dir, "ring")
+		self.socket_path = os.path.join(self.dir, "socket")
+
+		self.daemon = SpectrumSensorDaemon(SweepingSpectrumSensor(),
+				self.ring_path, self.socket_path, num_slots=8, max_channels=100)
+		self.daemon.serve()
+
+	def tearDown(self):
+		self.daemon.close()
+		shutil.rmtree(self.dir)
+
+	def test_control(self):
+		client = DaemonClient(self.socket_path)
+
+		self.assertRaises(Exception, client.command, "start")
+		self.assertRaises(Exception, client.command, "foo")
+
+		client.command("select channel 10:2:20 config 0,0")
+		client.command("start")
+
+		ring = SweepRing(self.ring_path)
+		sweep = ring.wait(3, timeout=5)
+		self.assertEquals(list(sweep.data), [-10., -12., -14., -16., -18.])
+
+		client.command("stop")
+		seq = ring.get_seq()
+		time.sleep(.05)
+		self.assertEquals(ring.get_seq(), seq)
+
+		resp = client.command("info")
+		self.assertEquals(resp, "ok seq %d channels 5 running 0" % (seq,))
+
+		client.close()
+
+	def test_run_error(self):
+		client = DaemonClient(self.socket_path)
+
+		self.daemon.sensor.fail_after = 3
+
+		client.command("select channel 10:2:20 config 0,0")
+		self.assertEquals(client.command("start"), "ok")
+
+		for n in xrange(500):
+			resp = client.command("info")
+			if "running 0" in resp:
+				break
+			time.sleep(.01)
+
+		self.assertEquals(resp, "ok seq 3 channels 5 running 0 last error device disconnected")
+		self.assertEquals(client.command("stop"), "ok last error device disconnected")
+
+		self.daemon.sensor.fail_after = None
+		self.assertEquals(client.command("start"), "ok last error device disconnected")
+
+		ring = SweepRing(self.ring_path)
+		for n in xrange(500):
+			if ring.get_seq() > 3:
+				break
+			time.sleep(.01)
+
+		self.assertTrue(ring.get_seq() > 3)
+
+		self.assertEquals(client.command("stop"), "ok")
+		self.assertEquals(client.command("info"), "ok seq %d channels 5 running 0" % (ring.get_seq(),))
+
+		client.close()
+
+class TestRecording(unittest.TestCase):
+	def setUp(self):
+		self.dir = tempfile.mkdtemp()
+		self.path = os.path.join(self.dir, "sweeps.rec")
+
+		dc = make_config(2, Device(1, "test"), "test config", spacing=10, bw=5)
+
+		self.sc = SweepConfig(dc, 10, 13, 1)
+
+		writer = RecordingWriter(self.path, self.sc, index_every=4, start_time=1000.)
+		for n in xrange(20):
+			sweep = Sweep()
+			sweep.timestamp = n * .5
+			sweep.data = [ -n, -1.5, -100.25 ]
+			writer(self.sc, sweep)
+		writer.close()
+
+	def tearDown(self):
+		shutil.rmtree(self.dir)
+
+	def test_read(self):
+		rec = Recording(self.path)
+
+		self.assertEquals(rec.num_sweeps, 20)
+		self.assertEquals(rec.start_time, 1000.)
+		self.assertEquals(list(rec.hz), [1100., 1110., 1120.])
+
+		sc = rec.sweep_config
+		self.assertEquals(sc.config.device.id, 1)
+		self.assertEquals(sc.config.id, 2)
+		self.assertEquals(sc.get_hz_list(), self.sc.get_hz_list())
+
+		sweep = rec.get_sweep(7)
+		self.assertEquals(sweep.timestamp, 3.5)
+		self.assertEquals(sweep.data, [-7., -1.5, -100.25])
+
+		rec.close()
+
+	def test_range(self):
+		rec = Recording(self.path)
+
+		self.assertEquals(rec.get_range(), (0, 20))
+		self.assertEquals(rec.get_range(2., 4.), (4, 8))
+		self.assertEquals(rec.get_range(2.1, 4.1), (5, 9))
+		self.assertEquals(rec.get_range(-1., 100.), (0, 20))
+		self.assertEquals(rec.get_range(9.5, None), (19, 20))
+
+		for t in xrange(-1, 22):
+			n = rec.find(t * .5 - .1)
+			self.assertEquals(n, min(20, max(0, t)))
+
+		rec.close()
+
+	def test_append(self):
+		writer = RecordingWriter(self.path, self.sc)
+		writer.append(0., [1., 2., 3.])
+		writer.flush()
+
+		rec = Recording(self.path)
+		self.assertEquals(rec.num_sweeps, 1)
+
+		writer.append(1., [1., 2., 3.])
+		writer.flush()
+
+		rec.refresh()
+		self.assertEquals(rec.num_sweeps, 2)
+
+		writer.close()
+		rec.close()
+
+	def test_replay(self):
+		rec = Recording(self.path)
+		replay = ReplaySource(rec)
+
+		sweeps = []
+		def cb(sweep_config, sweep):
+			sweeps.append(sweep)
+			return len(sweeps) < 3
+
+		replay.run(cb, speed=None, start=2.)
+		self.assertEquals([ sweep.timestamp for sweep in sweeps ], [2., 2.5, 3.])
+
+		sweeps = []
+		start = time.time()
+		replay.run(cb, speed=10., start=0.)
+		self.assertTrue(time.time() - start >= .09)
+
+		rec.close()
+
+class ChannelDeviceUnderTest(DeviceUnderTest):
+	def setup(self, options):
+		self.config = make_config(name="test config")
+
+		self.calls = []
+
+	def measure_ch_impl(self, ch, n):
+		self.calls.append(ch)
+		return range(n)
+
+class TestDeviceUnderTest(unittest.TestCase):
+	def setUp(self):
+		self.dir = tempfile.mkdtemp()
+
+	def tearDown(self):
+		shutil.rmtree(self.dir)
+
+	def test_group_channels(self):
+		self.assertEquals(group_channels([5]), [(5, 1, 6, [5])])
+		self.assertEquals(group_channels([30, 10, 20]), [(10, 10, 31, [10, 20, 30])])
+		self.assertEquals(group_channels([16, 50, 83]), [(16, 34, 51, [16, 50]), (83, 1, 84, [83])])
+		self.assertEquals(group_channels([1, 2, 4, 8, 9]), [(1, 1, 10, [1, 2, 4, 8, 9])])
+		self.assertEquals(group_channels([1, 3, 3, 5], max_ratio=1),
+				[(1, 2, 6, [1, 3, 5])])
+
+	def test_measure_ch_list(self):
+		dut = ChannelDeviceUnderTest("", "dut", log_path=self.dir)
+		dut._extra = 5
+
+		r = dut.measure_ch_list([10, 20], 3, ["a", "b"])
+		self.assertEquals(r, [[5, 6, 7], [5, 6, 7]])
+		self.assertEquals(dut.calls, [10, 20])
+
+	def test_replay(self):
+		dut = ChannelDeviceUnderTest("", "dut", log_path=self.dir)
+		r = dut.measure_ch_list([10, 20], 3, ["a", "b-1"])
+
+		dut = ChannelDeviceUnderTest("", "dut", log_path=self.dir, replay=True)
+		self.assertEquals(dut.measure_ch_list([10, 20], 3, ["a", "b-1"]), r)
+		self.assertEquals(dut.measure_ch(20, 3, "b-1"), r[1])
+		self.assertEquals(dut.calls, [])
+
+class GeneratorDeviceUnderTest(DeviceUnderTest):
+	def setup(self, options):
+		self.config = make_config(name="test config")
+
+		self.gen = FakeSignalGenerator()
+
+	def measure_ch_impl(self, ch, n):
+		# input power appears after 10 samples
+		if self.gen.is_on():
+			p = self.gen.power_dbm + ch
+		else:
+			p = -100.
+		return [-100.] * 10 + [p] * (n - 10)
+
+class TestPipelinedExecutor(unittest.TestCase):
+	def setUp(self):
+		self.dut = GeneratorDeviceUnderTest("", "dut")
+		self.gen = self.dut.gen
+
+	def test_run(self):
+		self.dut.set_settle_time(10)
+
+		steps = [ MeasurementStep(1, "a", 1000, -50),
+			MeasurementStep(2, "b"),
+			MeasurementStep(3, "c", 2000, -20) ]
+
+		results = PipelinedExecutor(self.dut, self.gen, 5).run(steps)
+
+		self.assertEquals(results, [(-49., 0.), (-100., 0.), (-17., 0.)])
+		self.assertEquals(self.gen.history, [(1000, -50), None, (2000, -20), None])
+
+	def test_run_ch_list(self):
+		self.dut.set_settle_time(10)
+
+		steps = [ MeasurementStep([1, 2], ["a1", "a2"], 1000, -50),
+			MeasurementStep(3, "b") ]
+
+		results = PipelinedExecutor(self.dut, self.gen, 5).run(steps)
+
+		self.assertEquals(results, [[(-49., 0.), (-48., 0.)], (-100., 0.)])
+		self.assertEquals(self.gen.history, [(1000, -50), None, None])
+
+	def test_settle_time(self):
+		self.dut.set_settle_time(5)
+
+		steps = [ MeasurementStep(0, "a", 1000, -50) ]
+		mean, std = PipelinedExecutor(self.dut, self.gen, 10).run(steps)[0]
+
+		self.assertEquals(mean, -75.)
+		self.assertEquals(std, 25.)
+
+	def test_error(self):
+		def analyze(measurements):
+			raise ValueError
+
+		steps = [ MeasurementStep(0, "a"), MeasurementStep(1, "b") ]
+		ex = PipelinedExecutor(self.dut, self.gen, 10, analyze)
+
+		self.assertRaises(ValueError, ex.run, steps)
+		self.assertEquals(self.gen.history, [None, None, None])
+
+def run_generator_worker(conn, settings):
+	gen = SharedSignalGenerator(conn, "shared")
+	for setting in settings:
+		if setting is None:
+			gen.rf_off()
+		elif setting == "acquire":
+			gen.acquire()
+		elif setting == "release":
+			gen.release()
+		else:
+			gen.rf_on(*setting)
+		time.sleep(.01)
+	gen.close()
+
+class TestGeneratorCoordinator(unittest.TestCase):
+	def run_workers(self, settings_list):
+		workers = []
+		for settings in settings_list:
+			conn, worker_conn = multiprocessing.Pipe()
+			process = multiprocessing.Process(target=run_generator_worker,
+					args=(worker_conn, settings))
+			process.start()
+			workers.append((conn, process))
+
+		gen = FakeSignalGenerator()
+		GeneratorCoordinator(gen, workers).run()
+
+		for conn, process in workers:
+			process.join()
+
+		return gen.history
+
+	def test_lockstep(self):
+		settings = [ None, (1000, -50), (1000, -40), None ]
+		history = self.run_workers([settings] * 3)
+
+		self.assertEquals(history, [None, (1000, -50), (1000, -40), None])
+
+	def test_diverging(self):
+		history = self.run_workers([
+			[ (1000, -50), (2000, -50) ],
+			[ (1000, -50), (3000, -50) ] ])
+
+		self.assertEquals(history[0], (1000, -50))
+		self.assertEquals(sorted(history[1:3]), [(2000, -50), (3000, -50)])
+		self.assertEquals(history[3:], [None])
+
+	def test_acquire(self):
+		history = self.run_workers([
+			[ "acquire", (1000, -50), (2000, -50), "release", None ],
+			[ "acquire", (3000, -50), "release", None ] ])
+
+		self.assertTrue(history[:3] in [
+			[ (1000, -50), (2000, -50), (3000, -50) ],
+			[ (3000, -50), (1000, -50), (2000, -50) ] ])
+		self.assertEquals(history[3:], [None])
+
+	def test_worker_exit(self):
+		conn, worker_conn = multiprocessing.Pipe()
+		process = multiprocessing.Process(target=time.sleep, args=(.1,))
+		process.start()
+
+		gen = FakeSignalGenerator()
+		GeneratorCoordinator(gen, [(conn, process)]).run()
+		process.join()
+
+		self.assertEquals(gen.history, [None])
+
+class TestFakeSensor(unittest.TestCase):
+	def setUp(self):
+		self.fake = FakeSensor(num_channels=100, rate=200., seed=0)
+		self.fake.start()
+
+		self.ss = SpectrumSensor(self.fake.path)
+
+	def tearDown(self):
+		self.ss.comm.close()
+		self.fake.close()
+
+	def test_config_list(self):
+		cl = self.ss.get_config_list()
+
+		dc = cl.get_config(0, 0)
+		self.assertEquals(dc.num, 100)
+		self.assertEquals(dc.base, 2400000000)
+
+	def test_run(self):
+		cl = self.ss.get_config_list()
+		sc = cl.get_config(0, 0).get_full_sweep_config(step_hz=200000)
+
+		sweeps = []
+		def cb(sweep_config, sweep):
+			sweeps.append(sweep)
+			return len(sweeps) < 5
+
+		self.ss.run(sc, cb)
+
+		self.assertEquals(len(sweeps), 5)
+		for sweep in sweeps:
+			self.assertEquals(len(sweep.data), 50)
+			self.assertTrue(all(-106 < v < -94 for v in sweep.data))
+
+		self.assertEquals(self.ss.get_fw_version(), "fake-sensor")
+
+	def test_corrupt(self):
+		self.fake.corrupt = .5
+
+		sc = self.ss.get_config_list().get_config(0, 0).get_full_sweep_config()
+
+		sweeps = []
+		def cb(sweep_config, batch):
+			sweeps.extend(batch.get_sweeps())
+			return len(sweeps) < 10
+
+		self.ss.run_batch(sc, cb)
+
+		self.assertTrue(len(sweeps) >= 10)
+		self.assertTrue(self.fake.num_corrupted > 0)
+		for sweep in sweeps:
+			self.assertEquals(len(sweep.data), 100)
+
+	def test_daemon(self):
+		dir = tempfile.mkdtemp()
+		try:
+			ring_path = os.path.join(dir, "ring")
+			socket_path = os.path.join(dir, "socket")
+
+			daemon = SpectrumSensorDaemon(self.ss, ring_path, socket_path,
+					num_slots=8, max_channels=100)
+			daemon.serve()
+
+			client = DaemonClient(socket_path)
+			client.command("select channel 0:4:100 config 0,0")
+			client.command("start")
+
+			ring = SweepRing(ring_path)
+			sweep = ring.wait(2, timeout=5)
+			self.assertEquals(len(sweep.data), 25)
+			self.assertTrue(all(-106 < v < -94 for v in sweep.data))
+
+			client.command("stop")
+			self.assertEquals(client.command("info"),
+					"ok seq %d channels 25 running 0" % (ring.get_seq(),))
+
+			client.close()
+			ring.close()
+			daemon.close()
+		finally:
+			shutil.rmtree(dir)
@@ -0,0 +1,156 @@
+/* Fast parser for sweep data reported by the VESNA spectrum sensor.
+ *
+ * See vesna/sweepparser.py for the pure Python implementation of the same
+ * interface. */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+/* Largest number of digits before and after the decimal point. Longer
+ * numbers are rejected, so that the parts can't overflow a long. */
+#define MAX_DIGITS 9
+
+/* Parse a decimal number in the format printed by the firmware (e.g.
+ * "-12.34") starting at *p. On success, store the value in v, move *p past
+ * the number and return 0.
+ *
+ * number = [ "-" ] 1*9DIGIT [ "." 1*9DIGIT ] */
+static int parse_number(const char** p, const char* end, double* v)
+{
+	const char* c = *p;
+	int sign = 1;
+	long ipart = 0;
+	long fpart = 0;
+	long fdiv = 1;
+	int digits = 0;
+
+	if(c < end && *c == '-') {
+		sign = -1;
+		c++;
+	}
+
+	while(c < end && *c >= '0' && *c <= '9') {
+		if(++digits > MAX_DIGITS) return -1;
+		ipart = ipart * 10 + (*c - '0');
+		c++;
+	}
+
+	if(!digits) return -1;
+
+	if(c < end && *c == '.') {
+		c++;
+		digits = 0;
+		while(c < end && *c >= '0' && *c <= '9') {
+			if(++digits > MAX_DIGITS) return -1;
+			fpart = fpart * 10 + (*c - '0');
+			fdiv *= 10;
+			c++;
+		}
+
+		if(!digits) return -1;
+	}
+
+	*v = sign * (ipart + (double) fpart / fdiv);
+	*p = c;
+
+	return 0;
+}
+
+/* Parse a single line "TS timestamp DS power ... DE" ending at end
+ * (excluding the new line). Fields are separated by single spaces and the
+ * line may end with a carriage return. Return 0 on success. */
+static int parse_line(const char* c, const char* end, Py_ssize_t num_channels,
+		double* timestamp, double* values)
+{
+	Py_ssize_t n;
+
+	if(end > c && end[-1] == '\r') end--;
+
+	if(end - c < 3 || memcmp(c, "TS ", 3)) return -1;
+	c += 3;
+
+	if(parse_number(&c, end, timestamp)) return -1;
+
+	if(end - c < 3 || memcmp(c, " DS", 3)) return -1;
+	c += 3;
+
+	for(n = 0; n < num_channels; n++) {
+		if(c >= end || *c != ' ') return -1;
+		c++;
+
+		if(parse_number(&c, end, &values[n])) return -1;
+	}
+
+	if(end - c != 3 || memcmp(c, " DE", 3)) return -1;
+
+	return 0;
+}
+
+static PyObject* sweepparser_parse(PyObject* self, PyObject* args)
+{
+	const char* data;
+	Py_ssize_t data_len;
+	Py_ssize_t start;
+	Py_ssize_t num_channels;
+	void* timestamps;
+	Py_ssize_t timestamps_len;
+	void* values;
+	Py_ssize_t values_len;
+
+	if(!PyArg_ParseTuple(args, "s#nnw#w#:parse", &data, &data_len, &start, &num_channels,
+				&timestamps, &timestamps_len, &values, &values_len)) {
+		return NULL;
+	}
+
+	if(start < 0 || start > data_len) {
+		PyErr_SetString(PyExc_ValueError, "start out of range");
+		return NULL;
+	}
+
+	if(num_channels <= 0) {
+		PyErr_SetString(PyExc_ValueError, "num_channels must be positive");
+		return NULL;
+	}
+
+	Py_ssize_t max_sweeps = timestamps_len / sizeof(double);
+	if(values_len / sizeof(double) / num_channels < (size_t) max_sweeps) {
+		max_sweeps = values_len / sizeof(double) / num_channels;
+	}
+
+	Py_ssize_t num_sweeps = 0;
+	Py_ssize_t num_corrupt = 0;
+
+	const char* c = data + start;
+	const char* end = data + data_len;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	while(num_sweeps < max_sweeps) {
+		const char* eol = memchr(c, '\n', end - c);
+		if(eol == NULL) break;
+
+		if(parse_line(c, eol, num_channels,
+					&((double*) timestamps)[num_sweeps],
+					&((double*) values)[num_sweeps * num_channels])) {
+			num_corrupt++;
+		} else {
+			num_sweeps++;
+		}
+
+		c = eol + 1;
+	}
+
+	Py_END_ALLOW_THREADS
+
+	return Py_BuildValue("nnn", num_sweeps, (Py_ssize_t) (c - data), num_corrupt);
+}
+
+static PyMethodDef sweepparser_methods[] = {
+	{ "parse", sweepparser_parse, METH_VARARGS,
+		"parse(data, start, num_channels, timestamps, values) -> (num_sweeps, end, num_corrupt)" },
+	{ NULL, NULL, 0, NULL }
+};
+
+PyMODINIT_FUNC init_sweepparser(void)
+{
+	Py_InitModule("_sweepparser", sweepparser_methods);
+}
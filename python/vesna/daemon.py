@@ -0,0 +1,382 @@
+"""Daemon sharing one spectrum sensor between several local processes.
+
+The daemon owns a SpectrumSensor and writes sweeps into a ring buffer in a
+memory-mapped file (e.g. in /dev/shm). Any number of consumers can map the same
+file and read sweeps without further copies through pipes. The sensor is controlled
+through line-based commands on a Unix socket:
+
+select channel START:STEP:STOP config DEVICE,CONFIG -- set sweep configuration
+start -- start sweeping
+stop -- stop sweeping
+info -- print ring buffer state
+
+Each command is answered with a line starting with "ok" or "error:". If the last
+sweep run ended with an exception, responses to start, stop and info end with
+"last error MESSAGE". The error is cleared when sweeping is started again.
+"""
+import array
+import mmap
+import os
+import re
+import socket
+import SocketServer
+import struct
+import threading
+import time
+
+from vesna.spectrumsensor import Sweep, SweepConfig, SpectrumSensorException
+
+class SweepRing:
+	"""Ring buffer of sweeps in a memory-mapped file.
+
+	File starts with a header:
+
+	magic, version -- "VSRB", 1
+	num_slots -- number of sweeps kept in the buffer
+	max_channels -- maximum number of channels in a sweep
+	seq -- sequence number of the last written sweep (0 if none)
+
+	followed by num_slots slots. Sweep with sequence number seq is stored in slot
+	seq % num_slots:
+
+	seq_begin -- sequence number, written before data
+	timestamp -- sweep start time in seconds
+	num_channels -- number of valid values in data
+	data -- max_channels doubles
+	seq_end -- sequence number, written after data
+
+	A reader copies the slot and then checks that seq_begin and seq_end match. If
+	they don't, the writer overwrote the slot during the copy.
+	"""
+
+	MAGIC = "VSRB"
+	VERSION = 1
+
+	_HEADER = struct.Struct("<4sIIIQ")
+	_SEQ = struct.Struct("<Q")
+	_SLOT_HEADER = struct.Struct("<QdI4x")
+
+	def __init__(self, path, num_slots=None, max_channels=None):
+		"""Open a ring buffer.
+
+		path -- path to the memory-mapped file.
+		num_slots, max_channels -- if given, create a new (empty) ring buffer with
+		                           this layout. Otherwise open an existing one.
+		"""
+		if num_slots is not None:
+			assert num_slots > 0
+			assert max_channels > 0
+
+			self.num_slots = num_slots
+			self.max_channels = max_channels
+
+			size = self._HEADER.size + num_slots * self._get_slot_size(max_channels)
+
+			# create in a temporary file and rename, so that readers never
+			# see a partially initialized buffer.
+			tmp_path = "%s.%d" % (path, os.getpid())
+			f = open(tmp_path, "w+b")
+			f.truncate(size)
+			f.write(self._HEADER.pack(self.MAGIC, self.VERSION, num_slots, max_channels, 0))
+			f.flush()
+			os.rename(tmp_path, path)
+		else:
+			f = open(path, "r+b")
+			magic, version, self.num_slots, self.max_channels, seq = \
+					self._HEADER.unpack(f.read(self._HEADER.size))
+			if magic != self.MAGIC or version != self.VERSION:
+				raise ValueError("%s is not a sweep ring buffer" % (path,))
+
+		self.slot_size = self._get_slot_size(self.max_channels)
+		self.mm = mmap.mmap(f.fileno(), 0)
+		f.close()
+
+	@classmethod
+	def _get_slot_size(cls, max_channels):
+		return cls._SLOT_HEADER.size + 8 * max_channels + cls._SEQ.size
+
+	def _get_slot_offset(self, seq):
+		return self._HEADER.size + (seq % self.num_slots) * self.slot_size
+
+	def get_seq(self):
+		"""Return the sequence number of the last written sweep (0 if none)."""
+		return self._SEQ.unpack_from(self.mm, self._HEADER.size - self._SEQ.size)[0]
+
+	def write(self, timestamp, data):
+		"""Write a sweep and return its sequence number.
+
+		timestamp -- sweep start time in seconds
+		data -- list or array of measurements
+		"""
+		num_channels = len(data)
+		assert num_channels <= self.max_channels
+
+		if not isinstance(data, array.array):
+			data = array.array('d', data)
+
+		seq = self.get_seq() + 1
+		off = self._get_slot_offset(seq)
+
+		data_off = off + self._SLOT_HEADER.size
+		end_off = data_off + 8 * self.max_channels
+
+		self._SLOT_HEADER.pack_into(self.mm, off, seq, timestamp, num_channels)
+		self.mm[data_off:data_off + 8 * num_channels] = data.tostring()
+		self._SEQ.pack_into(self.mm, end_off, seq)
+
+		self._SEQ.pack_into(self.mm, self._HEADER.size - self._SEQ.size, seq)
+
+		return seq
+
+	def read(self, seq):
+		"""Return the Sweep with sequence number seq.
+
+		Returns None if the sweep has not been written yet or has already been
+		overwritten.
+		"""
+		if seq <= 0:
+			return None
+
+		off = self._get_slot_offset(seq)
+		data_off = off + self._SLOT_HEADER.size
+		end_off = data_off + 8 * self.max_channels
+
+		seq_end = self._SEQ.unpack_from(self.mm, end_off)[0]
+		if seq_end != seq:
+			return None
+
+		seq_begin, timestamp, num_channels = self._SLOT_HEADER.unpack_from(self.mm, off)
+		data = array.array('d')
+		data.fromstring(self.mm[data_off:data_off + 8 * num_channels])
+
+		seq_begin = self._SLOT_HEADER.unpack_from(self.mm, off)[0]
+		if seq_begin != seq:
+			return None
+
+		sweep = Sweep()
+		sweep.timestamp = timestamp
+		sweep.data = data
+		return sweep
+
+	def get_view(self, seq):
+		"""Return (timestamp, buffer) for sweep with sequence number seq without copying.
+
+		buffer refers directly to measurements in the shared memory (use e.g.
+		numpy.frombuffer() to access it). Since the writer can overwrite the slot at any
+		time, call is_valid() after processing to check that data did not change.
+		Returns None if the sweep is not available.
+		"""
+		if seq <= 0 or self.get_seq() < seq:
+			return None
+
+		off = self._get_slot_offset(seq)
+		seq_begin, timestamp, num_channels = self._SLOT_HEADER.unpack_from(self.mm, off)
+		if seq_begin != seq:
+			return None
+
+		return timestamp, buffer(self.mm, off + self._SLOT_HEADER.size, 8 * num_channels)
+
+	def is_valid(self, seq):
+		"""Return True if sweep with sequence number seq has not been overwritten."""
+		off = self._get_slot_offset(seq)
+		end_off = off + self._SLOT_HEADER.size + 8 * self.max_channels
+
+		return self._SLOT_HEADER.unpack_from(self.mm, off)[0] == seq and \
+				self._SEQ.unpack_from(self.mm, end_off)[0] == seq
+
+	def wait(self, seq, timeout=None, poll=0.01):
+		"""Wait until sweep with sequence number seq is written and return it.
+
+		Returns None on timeout or if the sweep was overwritten in the meantime.
+		"""
+		start = time.time()
+		while self.get_seq() < seq:
+			if timeout is not None and time.time() - start > timeout:
+				return None
+			time.sleep(poll)
+
+		return self.read(seq)
+
+	def close(self):
+		self.mm.close()
+
+class _ControlHandler(SocketServer.StreamRequestHandler):
+	def handle(self):
+		while True:
+			line = self.rfile.readline()
+			if not line:
+				break
+
+			resp = self.server.sensor_daemon.command(line.strip())
+			self.wfile.write(resp + "\n")
+
+class _ControlServer(SocketServer.ThreadingMixIn, SocketServer.UnixStreamServer):
+	daemon_threads = True
+
+class SpectrumSensorDaemon:
+	"""Daemon publishing sweeps from a spectrum sensor into a SweepRing."""
+
+	def __init__(self, sensor, ring_path, socket_path, num_slots=64, max_channels=4096):
+		"""Create a new daemon.
+
+		sensor -- SpectrumSensor object.
+		ring_path -- path to the ring buffer file to create.
+		socket_path -- path to the Unix socket to listen on for commands.
+		num_slots -- number of sweeps kept in the ring buffer.
+		max_channels -- largest number of channels in a sweep.
+		"""
+		self.sensor = sensor
+		self.config_list = sensor.get_config_list()
+
+		self.ring = SweepRing(ring_path, num_slots, max_channels)
+
+		self.socket_path = socket_path
+		self.server = None
+
+		self.sweep_config = None
+
+		self._lock = threading.Lock()
+		self._thread = None
+		self._stop = threading.Event()
+
+		# exception that ended the last sweep run, if any
+		self.error = None
+
+	def _run(self):
+		def cb(sweep_config, sweep):
+			self.ring.write(sweep.timestamp, sweep.data)
+			return not self._stop.is_set()
+
+		try:
+			self.sensor.run(self.sweep_config, cb)
+		except Exception, e:
+			self.error = e
+		finally:
+			# error is recorded above first, so a stopped thread is
+			# never reported without the error that stopped it.
+			if self._thread is threading.current_thread():
+				self._thread = None
+
+	def select(self, start_ch, step_ch, stop_ch, device_id, config_id):
+		config = self.config_list.get_config(device_id, config_id)
+		if config is None:
+			raise ValueError("unknown config %d,%d" % (device_id, config_id))
+
+		sweep_config = SweepConfig(config, start_ch, stop_ch, step_ch)
+		if sweep_config.num_channels > self.ring.max_channels:
+			raise ValueError("too many channels")
+
+		self.stop()
+		self.sweep_config = sweep_config
+
+	def start(self):
+		"""Start sweeping, unless already running.
+
+		Returns the exception that ended the previous run, if any."""
+		if self.sweep_config is None:
+			raise ValueError("set channel config first")
+
+		if self._thread is not None:
+			return self.error
+
+		error = self.error
+		self.error = None
+
+		self._stop.clear()
+		self._thread = threading.Thread(target=self._run)
+		self._thread.daemon = True
+		self._thread.start()
+
+		return error
+
+	def stop(self):
+		"""Stop sweeping.
+
+		Returns the exception that ended the last run, if any."""
+		# the sweep thread clears _thread itself when the run fails
+		thread = self._thread
+		if thread is not None:
+			self._stop.set()
+			thread.join()
+			self._thread = None
+
+		return self.error
+
+	def _format_error(self, resp, error):
+		if error is None:
+			return resp
+		else:
+			return "%s last error %s" % (resp, error)
+
+	def command(self, cmd):
+		"""Execute a control command and return the response line."""
+		with self._lock:
+			try:
+				g = re.match("select channel ([0-9]+):([0-9]+):([0-9]+) config ([0-9]+),([0-9]+)$", cmd)
+				if g:
+					self.select(*map(int, g.groups()))
+				elif cmd == "start":
+					return self._format_error("ok", self.start())
+				elif cmd == "stop":
+					return self._format_error("ok", self.stop())
+				elif cmd == "info":
+					if self.sweep_config is None:
+						num_channels = 0
+					else:
+						num_channels = self.sweep_config.num_channels
+					resp = "ok seq %d channels %d running %d" % (
+							self.ring.get_seq(), num_channels,
+							self._thread is not None)
+					return self._format_error(resp, self.error)
+				else:
+					return "error: unknown command: %s" % (cmd,)
+			except Exception, e:
+				return "error: %s" % (e,)
+
+		return "ok"
+
+	def serve(self):
+		"""Start accepting commands on the Unix socket in a background thread."""
+		if os.path.exists(self.socket_path):
+			os.unlink(self.socket_path)
+
+		self.server = _ControlServer(self.socket_path, _ControlHandler)
+		self.server.sensor_daemon = self
+
+		thread = threading.Thread(target=self.server.serve_forever)
+		thread.daemon = True
+		thread.start()
+
+	def close(self):
+		"""Stop sweeping and accepting commands."""
+		if self.server is not None:
+			self.server.shutdown()
+			self.server.server_close()
+			os.unlink(self.socket_path)
+			self.server = None
+
+		self.stop()
+		self.ring.close()
+
+class DaemonClient:
+	"""Client for SpectrumSensorDaemon control socket."""
+
+	def __init__(self, socket_path):
+		self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		self.sock.connect(socket_path)
+		self.f = self.sock.makefile("r+b", 0)
+
+	def command(self, cmd):
+		"""Send a command and return the response line.
+
+		Raises an exception if the daemon returned an error.
+		"""
+		self.f.write(cmd + "\n")
+		resp = self.f.readline().strip()
+		if not resp.startswith("ok"):
+			raise SpectrumSensorException(resp)
+		return resp
+
+	def close(self):
+		self.f.close()
+		self.sock.close()
@@ -0,0 +1,204 @@
+"""Fake VESNA spectrum sensor on a pseudo-terminal.
+
+FakeSensor implements the serial protocol of the spectrum sensor firmware ("list",
+"select channel", "report-on", "report-off", "status", "version", ...) on a
+pseudo-terminal, so that SpectrumSensor and tools built on it can be tested and
+benchmarked without hardware:
+
+fake = FakeSensor(num_channels=1000, rate=50.)
+fake.start()
+
+sensor = SpectrumSensor(fake.path)
+...
+
+fake.close()
+"""
+import os
+import random
+import re
+import select
+import threading
+import time
+import tty
+
+VERSION = "fake-sensor"
+
+class FakeConfig:
+	"""Device configuration reported by the fake sensor."""
+	def __init__(self, name, base, spacing, bw, num, time):
+		self.name = name
+		self.base = base
+		self.spacing = spacing
+		self.bw = bw
+		self.num = num
+		self.time = time
+
+class FakeSensor:
+	"""Fake spectrum sensor, running in a background thread."""
+
+	def __init__(self, num_channels=1000, rate=10., corrupt=0., delay=0., configs=None,
+			seed=None):
+		"""Create a new fake sensor.
+
+		num_channels -- number of channels in the default device configuration.
+		rate -- number of sweeps per second while reporting.
+		corrupt -- probability that a sweep line is corrupted.
+		delay -- maximum random additional delay before each sweep line in seconds.
+		configs -- list of FakeConfig objects to report instead of the default
+		           configuration.
+		seed -- seed for the random generator, for reproducible output.
+		"""
+		if configs is None:
+			configs = [ FakeConfig("fake config", 2400000000, 100000, 100000,
+					num_channels, 1) ]
+
+		self.configs = configs
+		self.rate = rate
+		self.corrupt = corrupt
+		self.delay = delay
+
+		self.random = random.Random(seed)
+
+		self.path = None
+
+		self.num_sweeps = 0
+		self.num_corrupted = 0
+
+		self._master = None
+		self._slave = None
+		self._thread = None
+		self._stop = threading.Event()
+
+		self._sweep = None
+		self._report = False
+		self._report_start = None
+		self._next_sweep = None
+
+	def start(self):
+		"""Create the pseudo-terminal and start responding to commands.
+
+		Path to the pseudo-terminal is stored in the path attribute.
+		"""
+		self._master, self._slave = os.openpty()
+		tty.setraw(self._slave)
+		tty.setraw(self._master)
+
+		self.path = os.ttyname(self._slave)
+
+		self._thread = threading.Thread(target=self._run)
+		self._thread.daemon = True
+		self._thread.start()
+
+	def close(self):
+		"""Stop the fake sensor and close the pseudo-terminal."""
+		self._stop.set()
+		self._thread.join()
+
+		os.close(self._master)
+		os.close(self._slave)
+
+	def _write(self, data):
+		while data and not self._stop.is_set():
+			# don't block forever if nobody is reading
+			r, w, x = select.select([], [self._master], [], .1)
+			if w:
+				n = os.write(self._master, data[:1024])
+				data = data[n:]
+
+	def _format_sweep(self):
+		start_ch, step_ch, stop_ch, config = self._sweep
+
+		t = int((time.time() - self._report_start) * 1000)
+
+		fields = [ "TS", "%d.%03d" % (t // 1000, t % 1000), "DS" ]
+		for ch in xrange(start_ch, stop_ch, step_ch):
+			# noise floor around -100 dBm
+			p = self.random.randint(9500, 10500)
+			fields.append("-%d.%02d" % (p // 100, p % 100))
+		fields.append("DE")
+
+		line = " ".join(fields)
+
+		if self.corrupt and self.random.random() < self.corrupt:
+			# lost characters
+			i = self.random.randint(0, len(line) - 1)
+			line = line[:i] + line[i + self.random.randint(1, 10):]
+			self.num_corrupted += 1
+
+		return line + "\n"
+
+	def _dispatch(self, cmd):
+		if cmd == "list":
+			resp = "device 0: fake device\n"
+			for config_id, config in enumerate(self.configs):
+				resp += "  channel config 0,%d: %s\n" % (config_id, config.name)
+				resp += "    base: %d Hz\n" % (config.base,)
+				resp += "    spacing: %d Hz\n" % (config.spacing,)
+				resp += "    bw: %d Hz\n" % (config.bw,)
+				resp += "    num: %d\n" % (config.num,)
+				resp += "    time: %d ms\n" % (config.time,)
+			return resp
+
+		g = re.match("select channel ([0-9]+):([0-9]+):([0-9]+) config ([0-9]+),([0-9]+)$", cmd)
+		if g:
+			start_ch, step_ch, stop_ch, dev_id, config_id = map(int, g.groups())
+			if dev_id != 0 or config_id >= len(self.configs):
+				return "error: unknown device or config\n"
+
+			config = self.configs[config_id]
+			if start_ch >= stop_ch or stop_ch > config.num or step_ch <= 0:
+				return "error: invalid channel range\n"
+
+			self._sweep = (start_ch, step_ch, stop_ch, config)
+			return "ok\n"
+
+		if cmd == "report-on":
+			if self._sweep is None:
+				return "error: set channel config first\n"
+
+			self._report = True
+			self._report_start = time.time()
+			self._next_sweep = self._report_start
+			return ""
+
+		if cmd == "report-off":
+			self._report = False
+			return "ok\n"
+
+		if cmd in ("keep-warm-on", "keep-warm-off", "bench"):
+			return "ok\n"
+
+		if cmd == "status":
+			return "fake sensor: %d sweeps, %d corrupted\n" % (
+					self.num_sweeps, self.num_corrupted)
+
+		if cmd == "version":
+			return VERSION + "\n"
+
+		return "error: unknown command: %s\n" % (cmd,)
+
+	def _run(self):
+		buf = ""
+		while not self._stop.is_set():
+			if self._report:
+				timeout = max(0, self._next_sweep - time.time())
+			else:
+				timeout = .1
+
+			r, w, x = select.select([self._master], [], [], min(timeout, .1))
+
+			if r:
+				buf += os.read(self._master, 1024)
+
+				while "\n" in buf:
+					cmd, buf = buf.split("\n", 1)
+					self._write(self._dispatch(cmd.strip()))
+
+			if self._report and time.time() >= self._next_sweep:
+				if self.delay:
+					time.sleep(self.random.uniform(0, self.delay))
+
+				self._write(self._format_sweep())
+				self.num_sweeps += 1
+
+				self._next_sweep += 1. / self.rate
@@ -0,0 +1,254 @@
+import Queue
+import threading
+import time
+
+class MultiSweepPlan:
+	"""Partition of a frequency band between several spectrum sensors.
+
+	parts -- list of (sensor, SweepPlan) tuples, ordered by frequency
+	cost_us -- estimated time in microseconds for one pass over the band, i.e. the
+	           cost of the slowest part
+	"""
+	def __init__(self, parts, cost_us):
+		self.parts = parts
+		self.cost_us = cost_us
+
+	def get_hz_list(self):
+		"""Return a list of frequencies covered by this plan."""
+		hz_list = []
+		for sensor, plan in self.parts:
+			hz_list += plan.get_hz_list()
+		return hz_list
+
+class MultiSweep:
+	"""A single frequency sweep merged from sweeps on several spectrum sensors.
+
+	timestamp -- Time when the earliest part of the sweep started (in seconds since
+	             the start of sensing, as measured by the host)
+	skew -- Difference between start times of the latest and the earliest part (in
+	        seconds)
+	data -- List of measurements, one for each frequency in MultiSweepPlan.get_hz_list()
+	"""
+	def __init__(self):
+		self.timestamp = None
+		self.skew = None
+		self.data = []
+
+class MultiSpectrumSensor:
+	"""Several spectrum sensors, sweeping parts of a frequency band in parallel."""
+
+	def __init__(self, sensors):
+		"""Create a new multi-sensor object.
+
+		sensors -- list of SpectrumSensor objects.
+		"""
+		self.sensors = sensors
+		self.config_lists = [ sensor.get_config_list() for sensor in sensors ]
+
+	def get_sweep_plan(self, start_hz, stop_hz, step_hz, bw_hz=None, name=None):
+		"""Return a partition of a band between sensors that sweeps it in the shortest time.
+
+		Parameters are the same as for ConfigList.get_sweep_plan(). Each sensor sweeps
+		a contiguous part of the band. Sensors that wouldn't speed up the sweep are left
+		out. Returns None if the band can't be covered.
+		"""
+		assert stop_hz >= start_hz
+		assert step_hz > 0
+
+		last_n = int((stop_hz - start_hz) // step_hz)
+
+		# cache of (sensor index, first grid point, one past last grid point) -> SweepPlan
+		plans = {}
+
+		def get_plan(i, a, b):
+			key = (i, a, b)
+			if key not in plans:
+				plans[key] = self.config_lists[i].get_sweep_plan(
+						start_hz + a * step_hz, start_hz + (b - 1) * step_hz,
+						step_hz, bw_hz, name)
+			return plans[key]
+
+		def get_cost(i, a, b):
+			plan = get_plan(i, a, b)
+			if plan is None:
+				return None
+			else:
+				return plan.cost_us
+
+		def get_reach(i, a, max_cost):
+			# one past the last grid point sensor i can sweep from point a
+			# within max_cost. Cost grows with the number of points.
+			lo = a
+			hi = last_n + 1
+			while lo < hi:
+				mid = (lo + hi + 1) // 2
+				cost = get_cost(i, a, mid)
+				if cost is not None and (max_cost is None or cost <= max_cost):
+					lo = mid
+				else:
+					hi = mid - 1
+			return lo
+
+		def partition(max_cost):
+			# reach[used] = (b, parts): one past the furthest grid point that
+			# can be covered from the start of the band by giving consecutive
+			# parts to the sensors in the bit mask used, in any order. A
+			# sensor starting later never reaches less far, so keeping only
+			# the furthest point for each set of sensors is enough. Number of
+			# sets grows as 2^n, which is fine for a handful of sensors.
+			reach = { 0: (0, []) }
+			for used in xrange(1 << len(self.sensors)):
+				if used not in reach:
+					continue
+
+				a, parts = reach[used]
+				if a > last_n:
+					return parts
+
+				for i in xrange(len(self.sensors)):
+					if used & (1 << i):
+						continue
+
+					b = get_reach(i, a, max_cost)
+					if b <= a:
+						continue
+
+					key = used | (1 << i)
+					if key not in reach or b > reach[key][0]:
+						reach[key] = (b, parts + [(i, a, b)])
+
+			return None
+
+		parts = partition(None)
+		if parts is None:
+			return None
+
+		# binary search for the lowest cost of the slowest part
+		lo = 0
+		hi = max(get_cost(i, a, b) for i, a, b in parts)
+		while hi - lo > max(1, hi // 1000):
+			mid = (lo + hi) // 2
+			p = partition(mid)
+			if p is None:
+				lo = mid
+			else:
+				hi = mid
+				parts = p
+
+		return MultiSweepPlan(
+				[ (self.sensors[i], get_plan(i, a, b)) for i, a, b in parts ],
+				max(get_cost(i, a, b) for i, a, b in parts))
+
+	def _run_part(self, index, sensor, plan, queue, stop):
+		try:
+			if len(plan.segments) == 1:
+				# sensor keeps running a single sweep configuration
+				t0 = time.time()
+
+				def cb(sweep_config, sweep):
+					queue.put((index, t0 + sweep.timestamp, sweep.data))
+					return not stop.is_set()
+
+				sensor.run(plan.segments[0], cb)
+			else:
+				# sensor must be reconfigured for each segment
+				while not stop.is_set():
+					timestamp = None
+					data = []
+					for segment in plan.segments:
+						t0 = time.time()
+						sweeps = []
+
+						def cb(sweep_config, sweep):
+							sweeps.append(sweep)
+							return False
+
+						sensor.run(segment, cb)
+						if not sweeps:
+							return
+
+						if timestamp is None:
+							timestamp = t0 + sweeps[0].timestamp
+						data += sweeps[0].data
+
+					queue.put((index, timestamp, data))
+		except Exception, e:
+			queue.put((index, None, e))
+		else:
+			queue.put((index, None, None))
+
+	def run(self, multi_plan, cb):
+		"""Run the specified partitioned frequency sweep.
+
+		multi_plan -- MultiSweepPlan object
+		cb -- callback function.
+
+		This function continuously runs sweeps on all sensors in parallel. When each
+		sensor has completed a sweep of its part of the band, the latest sweeps are
+		merged and the provided callback function is called:
+
+		cb(multi_plan, sweep)
+
+		Where multi_plan is the MultiSweepPlan object provided when calling run() and
+		sweep the MultiSweep object with measured data. Sensing stops when the callback
+		returns False or when any of the sensors stops.
+		"""
+		queue = Queue.Queue()
+		stop = threading.Event()
+
+		threads = []
+		for index, (sensor, plan) in enumerate(multi_plan.parts):
+			thread = threading.Thread(target=self._run_part,
+					args=(index, sensor, plan, queue, stop))
+			thread.daemon = True
+			thread.start()
+			threads.append(thread)
+
+		start = time.time()
+
+		latest = [None] * len(threads)
+		done = [False] * len(threads)
+		error = None
+		while True:
+			# Queue.get() without a timeout can't be interrupted
+			try:
+				index, timestamp, data = queue.get(True, 1)
+			except Queue.Empty:
+				continue
+
+			if timestamp is None:
+				if data is not None:
+					error = data
+					break
+
+				# sensor stopped. Its last sweep can still be merged.
+				done[index] = True
+				if latest[index] is None:
+					break
+				else:
+					continue
+
+			latest[index] = (timestamp, data)
+
+			if None in latest:
+				continue
+
+			timestamps = [ t for t, d in latest ]
+
+			sweep = MultiSweep()
+			sweep.timestamp = min(timestamps) - start
+			sweep.skew = max(timestamps) - min(timestamps)
+			for t, d in latest:
+				sweep.data += d
+
+			latest = [None] * len(threads)
+
+			if not cb(multi_plan, sweep) or True in done:
+				break
+
+		stop.set()
+		for thread in threads:
+			thread.join()
+
+		if error is not None:
+			raise error
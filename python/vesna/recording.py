@@ -0,0 +1,318 @@
+"""Binary recording format for spectrum sensor sweeps.
+
+A recording consists of two files:
+
+PATH -- header followed by fixed-size sweep records.
+PATH.idx -- sparse timestamp index.
+
+Header:
+
+magic, version -- "VSRC", 1
+header_size -- offset of the first record
+num_channels -- number of measurements in each record
+index_every -- a record is added to the index every index_every sweeps
+start_time -- host time when the recording was created (seconds since epoch)
+config_size -- length of the config string
+config -- sweep configuration as a JSON string
+hz -- num_channels doubles, frequency of each measurement
+
+Record (stride 8 + 4 * num_channels bytes):
+
+timestamp -- double, seconds since start_time
+data -- num_channels floats, measurements in dBm
+
+Index entry:
+
+timestamp -- double, timestamp of the record
+n -- uint64, record number
+
+Records are only appended, so timestamps are non-decreasing as long as the source
+timestamps are.
+"""
+import array
+import bisect
+import json
+import mmap
+import os
+import struct
+import time
+
+from vesna.spectrumsensor import Device, DeviceConfig, Sweep, SweepConfig
+
+_HEADER = struct.Struct("<4sIIIIdI")
+_INDEX = struct.Struct("<dQ")
+
+MAGIC = "VSRC"
+VERSION = 1
+
+def _config_to_dict(sweep_config):
+	config = sweep_config.config
+	return {
+		"device_id": config.device.id,
+		"device_name": config.device.name,
+		"config_id": config.id,
+		"config_name": config.name,
+		"base": config.base,
+		"spacing": config.spacing,
+		"bw": getattr(config, "bw", None),
+		"num": config.num,
+		"time": getattr(config, "time", None),
+		"start_ch": sweep_config.start_ch,
+		"step_ch": sweep_config.step_ch,
+		"stop_ch": sweep_config.stop_ch,
+	}
+
+def _dict_to_config(d):
+	device = Device(d["device_id"], d["device_name"])
+
+	config = DeviceConfig(d["config_id"], d["config_name"], device)
+	config.base = d["base"]
+	config.spacing = d["spacing"]
+	config.bw = d["bw"]
+	config.num = d["num"]
+	config.time = d["time"]
+
+	return SweepConfig(config, d["start_ch"], d["stop_ch"], d["step_ch"])
+
+class RecordingWriter:
+	"""Appends sweeps to a recording.
+
+	An instance can be used directly as a callback for SpectrumSensor.run():
+
+	writer = RecordingWriter("sweeps.rec", sweep_config)
+	sensor.run(sweep_config, writer)
+	"""
+
+	def __init__(self, path, sweep_config, index_every=64, start_time=None):
+		"""Create a new recording.
+
+		path -- path to the recording. An existing recording is overwritten.
+		sweep_config -- SweepConfig object for the recorded sweeps.
+		index_every -- add every index_every-th sweep to the timestamp index.
+		start_time -- time the sweep timestamps are relative to (default: now).
+		"""
+		assert index_every > 0
+
+		if start_time is None:
+			start_time = time.time()
+
+		self.num_channels = sweep_config.num_channels
+		self.index_every = index_every
+		self.num_sweeps = 0
+
+		self._record = struct.Struct("<d%df" % (self.num_channels,))
+
+		config = json.dumps(_config_to_dict(sweep_config))
+		hz = array.array('d', sweep_config.get_hz_list())
+
+		header_size = _HEADER.size + len(config) + 8 * self.num_channels
+		# align records
+		header_size = (header_size + 7) // 8 * 8
+
+		self.f = open(path, "wb")
+		self.f.write(_HEADER.pack(MAGIC, VERSION, header_size, self.num_channels,
+				index_every, start_time, len(config)))
+		self.f.write(config)
+		self.f.write(hz.tostring())
+		self.f.write("\0" * (header_size - self.f.tell()))
+
+		self.index_f = open(path + ".idx", "wb")
+
+	def append(self, timestamp, data):
+		"""Append a sweep.
+
+		timestamp -- seconds since start_time
+		data -- list of measurements in dBm
+		"""
+		assert len(data) == self.num_channels
+
+		if self.num_sweeps % self.index_every == 0:
+			self.index_f.write(_INDEX.pack(timestamp, self.num_sweeps))
+
+		self.f.write(self._record.pack(timestamp, *data))
+		self.num_sweeps += 1
+
+	def flush(self):
+		"""Make appended sweeps visible to readers."""
+		self.f.flush()
+		self.index_f.flush()
+
+	def close(self):
+		self.f.close()
+		self.index_f.close()
+
+	def __call__(self, sweep_config, sweep):
+		self.append(sweep.timestamp, sweep.data)
+		return True
+
+class Recording:
+	"""Read-only, memory-mapped access to a recording."""
+
+	def __init__(self, path):
+		"""Open a recording.
+
+		path -- path to the recording.
+		"""
+		self.path = path
+
+		f = open(path, "rb")
+		magic, version, self.header_size, self.num_channels, self.index_every, \
+				self.start_time, config_size = _HEADER.unpack(f.read(_HEADER.size))
+		if magic != MAGIC or version != VERSION:
+			raise ValueError("%s is not a sweep recording" % (path,))
+
+		self.sweep_config = _dict_to_config(json.loads(f.read(config_size)))
+
+		self.hz = array.array('d')
+		self.hz.fromstring(f.read(8 * self.num_channels))
+
+		self._record = struct.Struct("<d%df" % (self.num_channels,))
+
+		self.mm = None
+		self.num_sweeps = 0
+		self.refresh()
+
+		f.close()
+
+	def refresh(self):
+		"""Map sweeps appended since the recording was opened."""
+		if self.mm is not None:
+			self.mm.close()
+
+		f = open(self.path, "rb")
+		size = os.fstat(f.fileno()).st_size
+
+		self.num_sweeps = (size - self.header_size) // self._record.size
+		self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+		f.close()
+
+		self._index_time = []
+		self._index_n = []
+		try:
+			index = open(self.path + ".idx", "rb").read()
+		except IOError:
+			index = ""
+
+		for off in xrange(0, len(index) - _INDEX.size + 1, _INDEX.size):
+			timestamp, n = _INDEX.unpack_from(index, off)
+			if n >= self.num_sweeps:
+				break
+			self._index_time.append(timestamp)
+			self._index_n.append(n)
+
+	def _get_offset(self, n):
+		return self.header_size + n * self._record.size
+
+	def get_timestamp(self, n):
+		"""Return timestamp of sweep number n."""
+		return struct.unpack_from("<d", self.mm, self._get_offset(n))[0]
+
+	def get_sweep(self, n):
+		"""Return sweep number n as a Sweep object."""
+		assert 0 <= n < self.num_sweeps
+
+		fields = self._record.unpack_from(self.mm, self._get_offset(n))
+
+		sweep = Sweep()
+		sweep.timestamp = fields[0]
+		sweep.data = list(fields[1:])
+		return sweep
+
+	def find(self, timestamp):
+		"""Return number of the first sweep with timestamp not less than timestamp."""
+		# sparse index gives a block of index_every sweeps to search
+		i = bisect.bisect_left(self._index_time, timestamp)
+		if i == 0:
+			lo = 0
+		else:
+			lo = self._index_n[i - 1]
+
+		if i < len(self._index_n):
+			hi = self._index_n[i]
+		else:
+			hi = self.num_sweeps
+
+		while lo < hi:
+			mid = (lo + hi) // 2
+			if self.get_timestamp(mid) < timestamp:
+				lo = mid + 1
+			else:
+				hi = mid
+		return lo
+
+	def get_range(self, start=None, stop=None):
+		"""Return (first, last) range of sweep numbers with start <= timestamp < stop.
+
+		last is one past the last sweep in the range.
+		"""
+		if start is None:
+			first = 0
+		else:
+			first = self.find(start)
+
+		if stop is None:
+			last = self.num_sweeps
+		else:
+			last = self.find(stop)
+
+		return first, last
+
+	def get_array(self, first=0, last=None):
+		"""Return measurements of sweeps from first to last as a numpy array.
+
+		Returns a (sweeps x channels) array view of the memory-mapped file, without
+		copying. Requires numpy.
+		"""
+		import numpy
+
+		if last is None:
+			last = self.num_sweeps
+
+		records = numpy.ndarray(shape=(last - first,),
+				dtype=[("timestamp", "<f8"), ("data", "<f4", (self.num_channels,))],
+				buffer=self.mm, offset=self._get_offset(first))
+		return records["data"]
+
+	def close(self):
+		if self.mm is not None:
+			self.mm.close()
+			self.mm = None
+
+class ReplaySource:
+	"""Replays a recording through the same callback API as SpectrumSensor.run()."""
+
+	def __init__(self, recording):
+		"""Create a new replay source.
+
+		recording -- Recording object.
+		"""
+		self.recording = recording
+		self.sweep_config = recording.sweep_config
+
+	def run(self, cb, speed=1., start=None, stop=None):
+		"""Replay recorded sweeps.
+
+		cb -- callback function, called as cb(sweep_config, sweep) for each sweep.
+		speed -- replay speed relative to the original timing. None replays as fast
+		         as possible.
+		start, stop -- optional range of timestamps to replay.
+
+		Replay ends at the end of the range or when the callback returns False.
+		"""
+		first, last = self.recording.get_range(start, stop)
+		if first >= last:
+			return
+
+		t0 = time.time()
+		ts0 = self.recording.get_timestamp(first)
+
+		for n in xrange(first, last):
+			sweep = self.recording.get_sweep(n)
+
+			if speed is not None:
+				delay = (sweep.timestamp - ts0) / speed - (time.time() - t0)
+				if delay > 0:
+					time.sleep(delay)
+
+			if not cb(self.sweep_config, sweep):
+				break
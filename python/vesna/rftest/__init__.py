@@ -1,5 +1,38 @@
+import fractions
+import math
 import optparse
 import os
+import Queue
+import select
+import threading
+
+def group_channels(ch_list, max_ratio=2.0):
+	"""Split a list of channels into groups that can be measured in one sweep.
+
+	Each group is returned as a (start_ch, step_ch, stop_ch, chs) tuple, where chs is a
+	list of requested channels covered by the sweep start_ch:step_ch:stop_ch. A group
+	is extended as long as the sweep covers at most max_ratio times as many channels
+	as were requested from it.
+	"""
+	chs = sorted(set(ch_list))
+
+	groups = []
+	i = 0
+	while i < len(chs):
+		step = 0
+		j = i + 1
+		while j < len(chs):
+			new_step = fractions.gcd(step, chs[j] - chs[i])
+			num = (chs[j] - chs[i]) // new_step + 1
+			if num > max_ratio * (j - i + 1):
+				break
+			step = new_step
+			j += 1
+
+		groups.append((chs[i], max(step, 1), chs[j-1] + 1, chs[i:j]))
+		i = j
+
+	return groups
 
 class usbtmc:
 	def __init__(self, device):
@@ -37,6 +70,320 @@ class SignalGenerator(usbtmc):
 	def rf_off(self):
 		self.write("outp off\n")
 
+class FakeSignalGenerator:
+	"""Signal generator stand-in for running tests without the instrument.
+
+	Settings are recorded in the history attribute as (freq_hz, power_dbm) tuples,
+	with None for RF off.
+	"""
+	def __init__(self, device=None):
+		self.freq_hz = None
+		self.power_dbm = None
+		self.history = []
+
+	def get_name(self):
+		return "fake signal generator"
+
+	def send_reset(self):
+		self.rf_off()
+
+	def close(self):
+		pass
+
+	def is_on(self):
+		return self.freq_hz is not None
+
+	def rf_on(self, freq_hz, power_dbm):
+		self.freq_hz = freq_hz
+		self.power_dbm = max(-145, power_dbm)
+		self.history.append((self.freq_hz, self.power_dbm))
+
+	def rf_off(self):
+		self.freq_hz = None
+		self.power_dbm = None
+		self.history.append(None)
+
+class SharedSignalGenerator:
+	"""Signal generator shared between several worker processes.
+
+	Used in a worker process in place of the signal generator. Each setting is sent
+	to a GeneratorCoordinator in the parent process, and the call returns only after
+	the generator has been set up as requested. The setting is then held until the
+	next call.
+	"""
+	def __init__(self, conn, name):
+		"""Create a new proxy.
+
+		conn -- worker end of a multiprocessing.Pipe() to the coordinator.
+		name -- name of the real signal generator.
+		"""
+		self.conn = conn
+		self.name = name
+
+	def get_name(self):
+		return self.name
+
+	def send_reset(self):
+		self.rf_off()
+
+	def _request(self, setting):
+		self.conn.send(setting)
+		self.conn.recv()
+
+	def rf_on(self, freq_hz, power_dbm):
+		self._request(("on", freq_hz, max(-145, power_dbm)))
+
+	def rf_off(self):
+		self._request(("off",))
+
+	def acquire(self):
+		"""Get exclusive use of the generator.
+
+		Blocks until all other workers are waiting for a setting. Settings are then
+		applied immediately and other workers are held until release() is called.
+		"""
+		self._request(("acquire",))
+
+	def release(self):
+		"""Return the generator to lockstep use by all workers."""
+		self._request(("release",))
+
+	def close(self):
+		"""Tell the coordinator that this worker no longer uses the generator."""
+		self.conn.send(("done",))
+		self.conn.close()
+
+class GeneratorCoordinator:
+	"""Applies settings requested by SharedSignalGenerator objects to a generator.
+
+	Workers are kept in lockstep: a new setting is applied only when every remaining
+	worker is waiting for a setting. The setting requested by most workers is then
+	applied and all of them continue in parallel. The other workers wait for the
+	next round, so workers whose test sequences differ are served one after another.
+
+	A worker that acquired the generator is served alone, without waiting for the
+	others, until it releases it.
+	"""
+	def __init__(self, gen, workers):
+		"""Create a new coordinator.
+
+		gen -- SignalGenerator or FakeSignalGenerator object.
+		workers -- list of (conn, process) tuples, where conn is the parent end of the
+		           pipe to the worker and process its multiprocessing.Process object.
+		"""
+		self.gen = gen
+		self.workers = workers
+		self.setting = None
+
+	def _apply(self, setting):
+		if setting == self.setting:
+			return
+
+		if setting[0] == "on":
+			self.gen.rf_on(setting[1], setting[2])
+		else:
+			self.gen.rf_off()
+
+		self.setting = setting
+
+	def run(self):
+		"""Serve requests until all workers are done."""
+		running = list(self.workers)
+		# requests in order of arrival
+		waiting = []
+		# worker with exclusive use of the generator
+		owner = None
+
+		while running:
+			if owner is not None:
+				conn, process = owner
+				if conn.poll(.1):
+					try:
+						setting = conn.recv()
+					except EOFError:
+						setting = ("done",)
+				elif not process.is_alive():
+					setting = ("done",)
+				else:
+					continue
+
+				if setting[0] == "done":
+					running.remove(owner)
+					owner = None
+					continue
+
+				if setting[0] == "release":
+					owner = None
+				else:
+					self._apply(setting)
+
+				try:
+					conn.send(True)
+				except IOError:
+					running.remove((conn, process))
+					owner = None
+				continue
+
+			busy = [ (conn, process) for conn, process in running
+					if conn not in [ w[0] for w in waiting ] ]
+
+			if not busy:
+				acquiring = [ w for w in waiting if w[1][0] == "acquire" ]
+				if acquiring:
+					conn = acquiring[0][0]
+					waiting.remove(acquiring[0])
+					owner = [ w for w in running if w[0] is conn ][0]
+					try:
+						conn.send(True)
+					except IOError:
+						running.remove(owner)
+						owner = None
+					continue
+
+				counts = {}
+				for conn, setting in waiting:
+					counts[setting] = counts.get(setting, 0) + 1
+
+				# prefer current setting and earlier requests on a tie
+				best = None
+				for conn, setting in waiting:
+					key = (counts[setting], setting == self.setting)
+					if best is None or key > best[0]:
+						best = (key, setting)
+
+				setting = best[1]
+				self._apply(setting)
+
+				for conn, s in waiting:
+					if s == setting:
+						try:
+							conn.send(True)
+						except IOError:
+							running = [ w for w in running if w[0] is not conn ]
+				waiting = [ w for w in waiting if w[1] != setting ]
+				continue
+
+			r, w, x = select.select([ conn.fileno() for conn, process in busy ],
+					[], [], .1)
+
+			for conn, process in busy:
+				if conn.fileno() in r:
+					try:
+						setting = conn.recv()
+					except EOFError:
+						setting = ("done",)
+				elif not process.is_alive():
+					setting = ("done",)
+				else:
+					continue
+
+				if setting[0] == "done":
+					running.remove((conn, process))
+				else:
+					waiting.append((conn, setting))
+
+		self._apply(("off",))
+
+def mean_std(measurements):
+	"""Return mean and standard deviation of a list of measurements."""
+	n = len(measurements)
+	mean = sum(measurements) / float(n)
+	std = math.sqrt(sum((m - mean) ** 2 for m in measurements) / n)
+	return mean, std
+
+class MeasurementStep:
+	"""A single point of a test: generator setting and measured channel.
+
+	f_hz and p_dbm set the generator output. The output is turned off if f_hz is None.
+
+	ch can also be a list of channels with name a list of names of the same length. The
+	channels are then measured together using measure_ch_list() and the result of the
+	step is a list of analysis results, one for each channel.
+	"""
+	def __init__(self, ch, name, f_hz=None, p_dbm=None):
+		self.ch = ch
+		self.name = name
+		self.f_hz = f_hz
+		self.p_dbm = p_dbm
+
+class PipelinedExecutor:
+	"""Runs a list of measurement steps with analysis overlapped with measurement.
+
+	Measurements are analyzed in a worker thread. While a measurement is being
+	analyzed, the main thread already sets the generator up for the next step and
+	starts measuring it.
+	"""
+	def __init__(self, dut, gen, n, analyze=mean_std):
+		"""Create a new executor.
+
+		dut -- DeviceUnderTest object.
+		gen -- SignalGenerator or FakeSignalGenerator object.
+		n -- number of samples to measure in each step.
+		analyze -- function called with the list of measurements of a step. Its
+		           return values are returned from run().
+		"""
+		self.dut = dut
+		self.gen = gen
+		self.n = n
+		self.analyze = analyze
+
+	def _set_gen(self, step):
+		if step.f_hz is None:
+			self.gen.rf_off()
+		else:
+			self.gen.rf_on(step.f_hz, step.p_dbm)
+
+	def _worker(self, steps, inq, outq):
+		while True:
+			item = inq.get()
+			if item is None:
+				break
+
+			i, measurements = item
+			try:
+				if isinstance(steps[i].ch, list):
+					result = map(self.analyze, measurements)
+				else:
+					result = self.analyze(measurements)
+				outq.put((i, result, None))
+			except Exception, e:
+				outq.put((i, None, e))
+
+	def run(self, steps):
+		"""Measure and analyze all steps and return a list of analysis results.
+
+		The generator output is turned off after the last step.
+		"""
+		inq = Queue.Queue()
+		outq = Queue.Queue()
+
+		worker = threading.Thread(target=self._worker, args=(steps, inq, outq))
+		worker.daemon = True
+		worker.start()
+
+		try:
+			for i, step in enumerate(steps):
+				self._set_gen(step)
+				if isinstance(step.ch, list):
+					measurements = self.dut.measure_ch_list(step.ch, self.n, step.name)
+				else:
+					measurements = self.dut.measure_ch(step.ch, self.n, step.name)
+				inq.put((i, measurements))
+		finally:
+			inq.put(None)
+			self.gen.rf_off()
+
+		worker.join()
+
+		results = [None] * len(steps)
+		while not outq.empty():
+			i, result, error = outq.get()
+			if error is not None:
+				raise error
+			results[i] = result
+
+		return results
+
 class DeviceUnderTest:
 	def __init__(self, args, name, device_id=0, config_id=0, replay=False, log_path=None):
 		self.name = name
@@ -69,6 +416,13 @@ class DeviceUnderTest:
 	def setup(self, options):
 		pass
 
+	def set_settle_time(self, n):
+		"""Set number of samples discarded at the start of each measurement.
+
+		n should be the settle time measured by the settle time test.
+		"""
+		self._extra = int(n)
+
 	def is_replay(self):
 		return self._replay
 
@@ -96,6 +450,37 @@ class DeviceUnderTest:
 	def measure_ch_impl(self, ch, n):
 		return [0.0] * n
 
+	def measure_ch_list(self, ch_list, n, name_list):
+		"""Measure n samples on each channel in ch_list.
+
+		Returns a list of measurement lists, one for each channel. Measurements are
+		saved (or replayed) under the corresponding name from name_list, same as with
+		measure_ch().
+		"""
+		assert len(ch_list) == len(name_list)
+
+		if self._replay:
+			return map(self._measure_ch_replay, name_list)
+		else:
+			return self._measure_ch_list_real(ch_list, n, name_list)
+
+	def _measure_ch_list_real(self, ch_list, n, name_list):
+		for ch in ch_list:
+			assert ch < self.config.num
+
+		measurements_list = self.measure_ch_list_impl(ch_list, n + self._extra)
+
+		result = []
+		for name, measurements in zip(name_list, measurements_list):
+			measurements = measurements[self._extra:]
+			self._measure_ch_save(name, measurements)
+			result.append(measurements)
+
+		return result
+
+	def measure_ch_list_impl(self, ch_list, n):
+		return [ self.measure_ch_impl(ch, n) for ch in ch_list ]
+
 	def _measure_ch_save(self, name, measurements):
 		if self.log_path:
 			path = ("%s/%s_%s.log" % (self.log_path, self.name, name)).replace("-", "m")
@@ -1,6 +1,12 @@
+import array
+import math
 import re
 import select
 import serial
+import struct
+
+from vesna import sweepparser
+from vesna.sweepstream import SweepStream
 
 class SpectrumSensorException(Exception): pass
 
@@ -41,6 +47,10 @@ class DeviceConfig:
 		self.name = name
 		self.device = device
 
+		# measured timing in microseconds, set if the sensor has been benchmarked
+		self.measured = None
+		self.setup = None
+
 	def ch_to_hz(self, ch):
 		"""Convert channel number to center frequency in hertz."""
 		assert ch >= 0
@@ -56,6 +66,22 @@ class DeviceConfig:
 		"""Return the highest settable frequency."""
 		return self.ch_to_hz(self.num - 1)
 
+	def get_channel_time_us(self):
+		"""Return time per channel in microseconds.
+
+		Measured time is used if available, nominal time otherwise."""
+		if self.measured is not None:
+			return self.measured
+		else:
+			return self.time * 1000
+
+	def get_setup_time_us(self):
+		"""Return measured setup time in microseconds or 0 if unknown."""
+		if self.setup is not None:
+			return self.setup
+		else:
+			return 0
+
 	def covers(self, start_hz, stop_hz):
 		"""Return true if this configuration can cover the given frequency band.
 
@@ -154,6 +180,188 @@ class Sweep:
 		self.timestamp = None
 		self.data = []
 
+class SweepBatch:
+	"""Measurement data from several consecutive frequency sweeps.
+
+	Attributes:
+
+	num -- Number of sweeps in the batch.
+	timestamp -- Array of times when each sweep started (in seconds since the start of
+	             sensing).
+	data -- Measurements in dBm. If numpy is available, a two-dimensional array with a
+	        row for each sweep. Otherwise a flat array.array with num_channels values
+	        for each sweep.
+
+	With numpy, arrays are views of buffers that are reused for the next batch. Copy
+	them if they are needed after the callback returns.
+	"""
+	def __init__(self, num_channels, max_sweeps):
+		self.num_channels = num_channels
+		self.num = 0
+
+		try:
+			import numpy
+		except ImportError:
+			self._numpy = False
+			self._timestamp_buf = array.array('d', [0.]) * max_sweeps
+			self._data_buf = array.array('d', [0.]) * (max_sweeps * num_channels)
+		else:
+			self._numpy = True
+			self._timestamp_buf = numpy.empty(max_sweeps)
+			self._data_buf = numpy.empty(max_sweeps * num_channels)
+
+	def _set_num(self, num):
+		self.num = num
+		self.timestamp = self._timestamp_buf[:num]
+		self.data = self._data_buf[:num * self.num_channels]
+		if self._numpy:
+			self.data = self.data.reshape((num, self.num_channels))
+
+	def get_sweeps(self):
+		"""Return a list of Sweep objects for sweeps in this batch."""
+		sweeps = []
+		for n in xrange(self.num):
+			sweep = Sweep()
+			sweep.timestamp = float(self._timestamp_buf[n])
+			sweep.data = list(self._data_buf[n * self.num_channels:(n + 1) * self.num_channels])
+			sweeps.append(sweep)
+		return sweeps
+
+class Occupancy:
+	"""Result of a single binary occupancy sweep.
+
+	Attributes:
+
+	timestamp -- Time when the sweep started (in seconds since the start of sensing)
+	data -- List of booleans, True for each busy channel sweeped.
+	"""
+	def __init__(self):
+		self.timestamp = None
+		self.data = []
+
+class ZeroSpanBlock:
+	"""Measurement data from a block of zero-span samples.
+
+	Attributes:
+
+	timestamp -- Time of the first sample (in seconds since the start of sensing)
+	interval -- Time between two samples in seconds
+	data -- List of measurements, one power measurement in dBm per sample.
+	"""
+	def __init__(self):
+		self.timestamp = None
+		self.interval = None
+		self.data = []
+
+def parse_log_dump(data, config_list):
+	"""Parse binary data returned by the "log-dump" command.
+
+	data -- frames from the flash log, each a 16-bit length followed by a compressed
+	        sweep or a session marker (see flash-log.h in the firmware).
+	config_list -- ConfigList object of the sensor that recorded the sweeps.
+
+	Returns a list of (sweep_config, sweep) tuples, oldest first. Sweeps that were
+	split into several frames are joined. Sweep timestamps are in seconds since the
+	start of the recorded sweep, which restarts with each session. Each sweep has a
+	session attribute with the number of the preceding session marker (None if the
+	marker has been overwritten) and a boot attribute that is true if the session was
+	the first after a reset of the sensor.
+	"""
+	header = struct.Struct("<BBBHIHHH")
+	session_header = struct.Struct("<BBI")
+
+	result = []
+	session = None
+	boot = False
+	# sweep that following frames of a split sweep are added to
+	last = None
+
+	i = 0
+	while i < len(data):
+		length, = struct.unpack_from("<H", data, i)
+		frame = data[i + 2:i + 2 + length]
+		i += 2 + length
+
+		if len(frame) != length:
+			raise ValueError("truncated frame")
+
+		type = ord(frame[0])
+		if type == 2:
+			type, flags, session = session_header.unpack_from(frame)
+			boot = bool(flags & 1)
+			last = None
+			continue
+		elif type != 1:
+			continue
+
+		type, device_id, config_id, scale, timestamp, start_ch, step_ch, num = \
+				header.unpack_from(frame)
+
+		config = config_list.get_config(device_id, config_id)
+		if config is None:
+			raise ValueError("unknown config %d,%d" % (device_id, config_id))
+
+		sweep = Sweep()
+		sweep.timestamp = timestamp * 1e-3
+		sweep.session = session
+		sweep.boot = boot
+
+		j = header.size
+		v = 0
+		for n in xrange(num):
+			zz = 0
+			shift = 0
+			while True:
+				b = ord(frame[j])
+				j += 1
+				zz |= (b & 0x7f) << shift
+				shift += 7
+				if not b & 0x80:
+					break
+
+			if zz & 1:
+				v -= (zz + 1) >> 1
+			else:
+				v += zz >> 1
+
+			sweep.data.append(v * scale / 100.0)
+
+		stop_ch = start_ch + step_ch * (num - 1) + 1
+
+		if last is not None:
+			last_config, last_sweep = last
+			if last_config.config is config and last_config.step_ch == step_ch and \
+					last_config.stop_ch + step_ch - 1 == start_ch and \
+					last_sweep.timestamp == sweep.timestamp:
+				last_sweep.data.extend(sweep.data)
+				last = (SweepConfig(config, last_config.start_ch, stop_ch, step_ch),
+						last_sweep)
+				result[-1] = last
+				continue
+
+		last = (SweepConfig(config, start_ch, stop_ch, step_ch), sweep)
+		result.append(last)
+
+	return result
+
+class SweepPlan:
+	"""Sequence of frequency sweeps that together cover a frequency band.
+
+	segments -- list of SweepConfig objects, ordered by frequency
+	cost_us -- estimated time in microseconds for one pass over all segments,
+	           including device setup
+	"""
+	def __init__(self, segments, cost_us):
+		self.segments = segments
+		self.cost_us = cost_us
+
+	def get_hz_list(self):
+		"""Return a list of frequencies covered by this plan."""
+		hz_list = []
+		for segment in self.segments:
+			hz_list += segment.get_hz_list()
+		return hz_list
+
 class ConfigList:
 	"""List of devices and device configurations supported by attached hardware."""
 
@@ -198,16 +406,100 @@ class ConfigList:
 			if not config.covers(start_hz, stop_hz):
 				continue
 
-			candidates.append(config)
+			candidates.append(config.get_sweep_config(start_hz, stop_hz, step_hz))
 
 		# pick fastest matching config
-		candidates.sort(key=lambda x:x.time, reverse=True)
+		candidates.sort(key=self._get_cost_us)
 
 		if candidates:
-			return candidates[0].get_sweep_config(start_hz, stop_hz, step_hz)
+			return candidates[0]
 		else:
 			return None
 
+	@staticmethod
+	def _get_cost_us(sweep_config):
+		config = sweep_config.config
+		return config.get_setup_time_us() + \
+				sweep_config.num_channels * config.get_channel_time_us()
+
+	def get_sweep_plan(self, start_hz, stop_hz, step_hz, bw_hz=None, name=None):
+		"""Return the cheapest sweep plan for specified requirements.
+
+		start_hz -- Lower bound of the frequency band to sweep (inclusive).
+		stop_hz -- Upper bound of the frequency band to sweep (inclusive).
+		step_hz -- Frequency step to use.
+		bw_hz -- Optional largest acceptable resolution bandwidth.
+		name -- Optional required sub-string in device configuration name.
+
+		The band is measured at frequencies start_hz + n * step_hz. It can be split
+		into segments, each swept by a different configuration, possibly on different
+		devices. The plan with the lowest sum of setup time and time per channel
+		(measured by the "bench" command or nominal if not available) is returned.
+		Returns None if the band can't be covered.
+		"""
+		assert stop_hz >= start_hz
+		assert step_hz > 0
+
+		# index of the last point on the frequency grid
+		last_n = int((stop_hz - start_hz) // step_hz)
+
+		# usable configurations with the range of grid points each covers
+		candidates = []
+		for config in self.configs:
+			if name and name not in config.name:
+				continue
+
+			if bw_hz is not None and config.bw > bw_hz:
+				continue
+
+			# all measured frequencies must be on the channel grid
+			if step_hz % config.spacing or (start_hz - config.base) % config.spacing:
+				continue
+
+			first = max(0, int(math.ceil(float(config.get_start_hz() - start_hz) / step_hz)))
+			last = min(last_n, int(math.floor(float(config.get_stop_hz() - start_hz) / step_hz)))
+			if first > last:
+				continue
+
+			candidates.append((config, first, last))
+
+		# possible segment boundaries, as grid point indexes
+		bounds = set([0, last_n + 1])
+		for config, first, last in candidates:
+			bounds.add(first)
+			bounds.add(last + 1)
+		bounds = sorted(bounds)
+
+		# best[i] = (cost, segments) of the cheapest plan covering grid points
+		# before bounds[i]
+		best = [None] * len(bounds)
+		best[0] = (0, [])
+
+		for i in xrange(len(bounds)):
+			if best[i] is None:
+				continue
+
+			for j in xrange(i + 1, len(bounds)):
+				for config, first, last in candidates:
+					if first > bounds[i] or last < bounds[j] - 1:
+						continue
+
+					cost = best[i][0] + config.get_setup_time_us() + \
+						(bounds[j] - bounds[i]) * config.get_channel_time_us()
+
+					if best[j] is None or cost < best[j][0]:
+						best[j] = (cost, best[i][1] + [(config, bounds[i], bounds[j])])
+
+		if best[-1] is None:
+			return None
+
+		segments = []
+		for config, a, b in best[-1][1]:
+			segments.append(config.get_sweep_config(
+				start_hz + a * step_hz, start_hz + (b - 1) * step_hz, step_hz))
+
+		return SweepPlan(segments, best[-1][0])
+
 class SpectrumSensor:
 	"""Top-level abstraction of the attached spectrum sensing hardware."""
 
@@ -294,6 +586,98 @@ class SpectrumSensor:
 
 		return resp
 
+	def bench(self):
+		"""Measure setup time and time per channel for all device configurations.
+
+		Results are reported in the "measured" and "setup" attributes of DeviceConfig
+		objects returned by subsequent calls to get_config_list().
+		"""
+		self.comm.write("bench\n")
+		self._wait_for_ok()
+
+	def set_keep_warm(self, keep_warm):
+		"""Keep the spectrum sensing device powered on between sweeps.
+
+		keep_warm -- if True, the device is not put into standby when a sweep stops. This
+		lowers the latency of starting the next sweep with unchanged configuration at the
+		expense of power consumption.
+		"""
+		if keep_warm:
+			self.comm.write("keep-warm-on\n")
+		else:
+			self.comm.write("keep-warm-off\n")
+
+		self._wait_for_ok()
+
+	def set_record(self, record):
+		"""Store sweeps in the flash log on the sensor.
+
+		record -- if True, sweeps started with the "report-on" command are also stored in
+		the flash memory of the sensor, so that they can be read later with log_dump(),
+		e.g. after a loss of connection to the host.
+		"""
+		if record:
+			self.comm.write("record-on\n")
+		else:
+			self.comm.write("record-off\n")
+
+		self._wait_for_ok()
+
+	def save_config(self, autostart=False):
+		"""Save current settings to the flash memory of the sensor.
+
+		The last selected channels and report mode, the keep-warm and the record setting
+		are restored when the sensor boots, for example after a watchdog reset.
+
+		autostart -- if True, the sensor also starts the sweep at boot, without waiting
+		for a command from the host.
+		"""
+		if autostart:
+			self.comm.write("config-save autostart\n")
+		else:
+			self.comm.write("config-save\n")
+
+		self._wait_for_ok()
+
+	def clear_config(self):
+		"""Don't restore any settings when the sensor boots."""
+		self.comm.write("config-clear\n")
+		self._wait_for_ok()
+
+	def log_dump(self, config_list=None):
+		"""Read all sweeps stored in the flash log.
+
+		config_list -- ConfigList object for the sensor (queried if not given).
+
+		Returns a list of (sweep_config, sweep) tuples, oldest first (see
+		parse_log_dump()).
+		"""
+		if config_list is None:
+			config_list = self.get_config_list()
+
+		self.comm.write("log-dump\n")
+
+		line = self.comm.readline()
+		fields = line.split()
+		if len(fields) not in (7, 9) or fields[0] != "LS":
+			raise SpectrumSensorException(line.strip())
+
+		num = int(fields[4])
+
+		self.comm.timeout = None
+		raw = self.comm.read(num)
+		self.comm.timeout = 0.5
+
+		if len(raw) != num or self.comm.readline() != "LE\n":
+			raise SpectrumSensorException("corrupted log dump")
+
+		return parse_log_dump(raw, config_list)
+
+	def log_erase(self):
+		"""Remove all sweeps from the flash log."""
+		self.comm.write("log-erase\n")
+		self._wait_for_ok()
+
 	def _select_channel(self, sweep_config):
 		self.comm.write("select channel %d:%d:%d config %d,%d\n" % (
 				sweep_config.start_ch, sweep_config.step_ch, sweep_config.stop_ch,
@@ -352,3 +736,217 @@ class SpectrumSensor:
 		self.comm.write("report-off\n")
 
 		self._wait_for_ok()
+
+	def stream(self, sweep_config, maxsize=16, policy=SweepStream.DROP_OLDEST):
+		"""Start the specified frequency sweep in a background thread.
+
+		sweep_config -- frequency sweep configuration object
+		maxsize -- maximum number of sweeps waiting to be processed.
+		policy -- what to do when maxsize sweeps are waiting (see SweepStream).
+
+		Returns a started SweepStream object. Iterating over it returns Sweep objects
+		until stop() is called on it:
+
+		stream = sensor.stream(sweep_config)
+		for sweep in stream:
+			...
+		"""
+		stream = SweepStream(self, sweep_config, maxsize, policy)
+		stream.start()
+		return stream
+
+	def run_batch(self, sweep_config, cb, max_sweeps=64):
+		"""Run the specified frequency sweep, parsing sweeps in batches.
+
+		sweep_config -- frequency sweep configuration object
+		cb -- callback function.
+		max_sweeps -- maximum number of sweeps passed to a single callback call.
+
+		This is a faster alternative to run() for high sweep rates. Data is read from
+		the serial port in large chunks and all complete sweeps in a chunk are parsed
+		at once. The provided callback function is called for each batch of sweeps:
+
+		cb(sweep_config, batch)
+
+		Where sweep_config is the SweepConfig object provided when calling run_batch()
+		and batch the SweepBatch object with measured data.
+		"""
+
+		batch = SweepBatch(sweep_config.num_channels, max_sweeps)
+
+		self._select_channel(sweep_config)
+
+		self.comm.write("report-on\n")
+
+		self.comm.timeout = None
+
+		buf = ""
+		running = True
+		while running:
+			try:
+				chunk = self.comm.read(max(1, self.comm.inWaiting()))
+			except select.error:
+				break
+
+			if not chunk:
+				break
+
+			buf += chunk
+
+			start = 0
+			while True:
+				num, start, num_corrupt = sweepparser.parse(buf, start,
+						sweep_config.num_channels,
+						batch._timestamp_buf, batch._data_buf)
+
+				if num_corrupt:
+					print "Ignoring %d corrupted lines" % (num_corrupt,)
+
+				if not num:
+					break
+
+				batch._set_num(num)
+				if not cb(sweep_config, batch):
+					running = False
+					break
+
+			buf = buf[start:]
+
+		self.comm.timeout = 0.5
+
+		self.comm.write("report-off\n")
+
+		self._wait_for_ok()
+
+	def run_occupancy(self, sweep_config, threshold, cb):
+		"""Run the specified frequency sweep in binary occupancy mode.
+
+		sweep_config -- frequency sweep configuration object
+		threshold -- device specific carrier sense threshold in dB
+		cb -- callback function.
+
+		This function continuously checks channels in the specified frequency sweep
+		for presence of a carrier. The provided callback function is called for each
+		completed sweep:
+
+		cb(sweep_config, occupancy)
+
+		Where sweep_config is the SweepConfig object provided when calling run_occupancy()
+		and occupancy the Occupancy object with measured data.
+		"""
+
+		self._select_channel(sweep_config)
+
+		self.comm.write("select occupancy threshold %d\n" % (threshold,))
+		self._wait_for_ok()
+
+		self.comm.write("report-on\n")
+
+		self.comm.timeout = None
+
+		while True:
+			try:
+				line = self.comm.readline()
+			except select.error:
+				break
+
+			if not line:
+				break
+
+			try:
+				fields = line.split()
+				if len(fields) != 3 or fields[0] != "OS":
+					raise ValueError
+
+				num = int(fields[2])
+				if num != sweep_config.num_channels:
+					raise ValueError
+
+				raw = self.comm.read((num + 7) / 8)
+				if len(raw) != (num + 7) / 8 or self.comm.readline() != "OE\n":
+					raise ValueError
+
+				occupancy = Occupancy()
+
+				occupancy.timestamp = float(fields[1])
+				occupancy.data = [ bool((ord(raw[n/8]) >> (n%8)) & 1) for n in xrange(num) ]
+			except ValueError:
+				print "Ignoring corrupted sweep: %s" % (line,)
+				continue
+
+			if not cb(sweep_config, occupancy):
+				break
+
+		self.comm.timeout = 0.5
+
+		self.comm.write("report-off\n")
+
+		self._wait_for_ok()
+
+	def run_zero_span(self, config, ch, interval_us, block_len, cb):
+		"""Run a zero-span (time-domain) measurement on a single channel.
+
+		config -- device configuration object to use
+		ch -- channel to sample
+		interval_us -- time between two samples in microseconds
+		block_len -- number of samples in a block (at most 4096, and a block may
+		             not be longer than 1 s)
+
+		The sensor stops with an error if it can't take a sample within interval_us.
+		cb -- callback function.
+
+		This function continuously samples power on the specified channel. The provided
+		callback function is called for each block of samples:
+
+		cb(config, block)
+
+		Where config is the DeviceConfig object provided when calling run_zero_span() and
+		block the ZeroSpanBlock object with measured data.
+		"""
+
+		self._select_channel(SweepConfig(config, ch, ch+1, 1))
+
+		self.comm.write("select zero-span channel %d interval %d block %d\n" % (
+				ch, interval_us, block_len))
+		self._wait_for_ok()
+
+		self.comm.write("report-on\n")
+
+		self.comm.timeout = None
+
+		while True:
+			try:
+				line = self.comm.readline()
+			except select.error:
+				break
+
+			if not line:
+				break
+
+			try:
+				fields = line.split()
+				if len(fields) != 4 or fields[0] != "ZS":
+					raise ValueError
+
+				num = int(fields[3])
+				raw = self.comm.read(num * 2)
+				if len(raw) != num * 2 or self.comm.readline() != "ZE\n":
+					raise ValueError
+
+				block = ZeroSpanBlock()
+
+				block.timestamp = int(fields[1]) * 1e-6
+				block.interval = int(fields[2]) * 1e-6
+				block.data = [ v / 100.0 for v in struct.unpack("<%dh" % (num,), raw) ]
+			except (ValueError, struct.error):
+				print "Ignoring corrupted block: %s" % (line,)
+				continue
+
+			if not cb(config, block):
+				break
+
+		self.comm.timeout = 0.5
+
+		self.comm.write("report-off\n")
+
+		self._wait_for_ok()
@@ -0,0 +1,74 @@
+"""Parser for sweep data reported by the VESNA spectrum sensor.
+
+parse(data, start, num_channels, timestamps, values) -> (num_sweeps, end, num_corrupt)
+
+Parses complete "TS timestamp DS power ... DE" lines from the string data, starting
+at index start. Fields must be separated by single spaces and a line may end with a
+carriage return. Numbers must be in the format printed by the firmware: an optional
+minus sign, 1 to 9 digits and optionally a decimal point followed by 1 to 9 digits
+(e.g. "-12.34"). Sweep start times are stored into the timestamps buffer and
+measurements into the values buffer, num_channels values per sweep. Buffers must be writable arrays of doubles
+(e.g. array.array('d') or a numpy array of float64). Parsing stops when the buffers
+are full or no complete line is left in data.
+
+Returns the number of parsed sweeps, the index in data after the last parsed line
+and the number of lines skipped because they weren't valid sweeps.
+
+A compiled implementation is used if available.
+"""
+import array
+import re
+
+# Largest number of digits before and after the decimal point
+MAX_DIGITS = 9
+
+_number = re.compile(r"-?[0-9]{1,%d}(\.[0-9]{1,%d})?\Z" % (MAX_DIGITS, MAX_DIGITS))
+
+def _parse_number(field):
+	if _number.match(field) is None:
+		raise ValueError(field)
+	return float(field)
+
+def _parse(data, start, num_channels, timestamps, values):
+	max_sweeps = min(len(timestamps), len(values) // num_channels)
+
+	num_sweeps = 0
+	num_corrupt = 0
+	end = start
+
+	while num_sweeps < max_sweeps:
+		eol = data.find("\n", end)
+		if eol < 0:
+			break
+
+		line = data[end:eol]
+		end = eol + 1
+
+		if line.endswith("\r"):
+			line = line[:-1]
+
+		fields = line.split(" ")
+		if len(fields) != num_channels + 4 or fields[0] != "TS" or \
+				fields[2] != "DS" or fields[-1] != "DE":
+			num_corrupt += 1
+			continue
+
+		try:
+			timestamp = _parse_number(fields[1])
+			sweep = map(_parse_number, fields[3:-1])
+		except ValueError:
+			num_corrupt += 1
+			continue
+
+		timestamps[num_sweeps] = timestamp
+		values[num_sweeps * num_channels:(num_sweeps + 1) * num_channels] = \
+				array.array('d', sweep)
+
+		num_sweeps += 1
+
+	return num_sweeps, end, num_corrupt
+
+try:
+	from vesna._sweepparser import parse
+except ImportError:
+	parse = _parse
@@ -0,0 +1,135 @@
+import Queue
+import threading
+
+class SweepStream:
+	"""Stream of sweeps from a spectrum sensor, acquired in a background thread.
+
+	Sweeps are passed from the acquisition thread to the consumer through a bounded
+	queue, so that slow processing does not stall reading from the serial port. What
+	happens when the queue is full depends on the policy:
+
+	DROP_OLDEST -- the oldest queued sweep is discarded (default).
+	BLOCK -- acquisition waits until the consumer takes a sweep from the queue. After
+	         stop(), the oldest queued sweep is discarded instead.
+
+	Attributes:
+
+	dropped -- number of sweeps discarded because the queue was full.
+	received -- number of sweeps received from the sensor.
+	"""
+
+	DROP_OLDEST = "drop-oldest"
+	BLOCK = "block"
+
+	def __init__(self, sensor, sweep_config, maxsize=16, policy=DROP_OLDEST):
+		"""Create a new stream.
+
+		sensor -- SpectrumSensor object.
+		sweep_config -- frequency sweep configuration object.
+		maxsize -- maximum number of sweeps in the queue.
+		policy -- what to do when the queue is full (DROP_OLDEST or BLOCK).
+		"""
+		assert maxsize > 0
+		assert policy in (self.DROP_OLDEST, self.BLOCK)
+
+		self.sensor = sensor
+		self.sweep_config = sweep_config
+		self.policy = policy
+
+		self.dropped = 0
+		self.received = 0
+
+		self._queue = Queue.Queue(maxsize)
+		self._lock = threading.Lock()
+		self._stop = threading.Event()
+		self._thread = None
+		self._done = False
+
+	def _put(self, item):
+		if self.policy == self.BLOCK:
+			# after stop() the consumer might not read from the queue any
+			# more, so don't block the acquisition thread then
+			while not self._stop.is_set():
+				try:
+					self._queue.put(item, True, .1)
+					return
+				except Queue.Full:
+					pass
+
+		with self._lock:
+			while True:
+				try:
+					self._queue.put_nowait(item)
+					break
+				except Queue.Full:
+					pass
+
+				try:
+					self._queue.get_nowait()
+					self.dropped += 1
+				except Queue.Empty:
+					pass
+
+	def _run(self):
+		def cb(sweep_config, sweep):
+			self.received += 1
+			self._put((sweep, None))
+			return not self._stop.is_set()
+
+		try:
+			self.sensor.run(self.sweep_config, cb)
+		except Exception, e:
+			self._put((None, e))
+		else:
+			self._put((None, None))
+
+	def start(self):
+		"""Start acquisition in a background thread."""
+		assert self._thread is None
+
+		self._thread = threading.Thread(target=self._run)
+		self._thread.daemon = True
+		self._thread.start()
+
+	def stop(self):
+		"""Stop acquisition.
+
+		The sensor is stopped after it reports the next sweep. Sweeps already in the
+		queue can still be read.
+		"""
+		self._stop.set()
+
+	def get(self, timeout=None):
+		"""Return the next sweep.
+
+		Blocks for up to timeout seconds (forever if None) and returns None on timeout or
+		if the stream has ended. Re-raises the exception if acquisition failed.
+		"""
+		if self._done:
+			return None
+
+		# Queue.get() without a timeout can't be interrupted
+		while True:
+			try:
+				sweep, error = self._queue.get(True, 1 if timeout is None else timeout)
+				break
+			except Queue.Empty:
+				if timeout is not None:
+					return None
+
+		if sweep is None:
+			self._done = True
+			if error is not None:
+				raise error
+
+		return sweep
+
+	def __iter__(self):
+		while True:
+			sweep = self.get()
+			if sweep is None:
+				break
+			yield sweep
+
+		if self._thread is not None:
+			self._thread.join()
@@ -0,0 +1,98 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+
+/* Settings saved in a flash page */
+
+#include <string.h>
+#include "spectrum.h"
+#include "settings.h"
+
+static int settings_slot_num(const struct flash_region* region)
+{
+	return region->page_size / sizeof(struct settings_slot);
+}
+
+static const struct settings_slot* settings_get_slot(const struct flash_region* region, int n)
+{
+	return (const struct settings_slot*) (region->base + n * sizeof(struct settings_slot));
+}
+
+/* Return the index of the slot with current settings or -1 if there are none. */
+static int settings_find(const struct flash_region* region)
+{
+	int n, found = -1;
+	for(n = 0; n < settings_slot_num(region); n++) {
+		if (settings_get_slot(region, n)->magic == SETTINGS_MAGIC) {
+			found = n;
+		}
+	}
+	return found;
+}
+
+/* Read saved settings.
+ *
+ * Return 0 on success, E_SPECTRUM_INVALID if no settings are saved or other
+ * error code otherwise. */
+int settings_load(const struct flash_region* region, struct settings* settings)
+{
+	int n = settings_find(region);
+	if (n < 0) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	memcpy(settings, &settings_get_slot(region, n)->settings, sizeof(*settings));
+
+	return E_SPECTRUM_OK;
+}
+
+/* Save settings, unless they are equal to the saved ones.
+ *
+ * Return 0 on success, or error code otherwise. */
+int settings_save(const struct flash_region* region, const struct settings* settings)
+{
+	int n = settings_find(region);
+	int r;
+
+	if (n >= 0 && !memcmp(&settings_get_slot(region, n)->settings, settings,
+				sizeof(*settings))) {
+		return E_SPECTRUM_OK;
+	}
+
+	/* first free slot after the current one, skipping partially written ones */
+	for(n++; n < settings_slot_num(region); n++) {
+		if (flash_is_erased(region, n * sizeof(struct settings_slot),
+					sizeof(struct settings_slot))) {
+			break;
+		}
+	}
+
+	if (n >= settings_slot_num(region)) {
+		r = region->erase_page(region, 0);
+		if (r) return r;
+
+		n = 0;
+	}
+
+	int offset = n * sizeof(struct settings_slot);
+	uint32_t magic = SETTINGS_MAGIC;
+
+	r = region->program(region, offset, settings, sizeof(*settings));
+	if (r) return r;
+
+	return region->program(region, offset + sizeof(*settings), &magic, sizeof(magic));
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+#ifndef HAVE_SETTINGS_H
+#define HAVE_SETTINGS_H
+
+#include <stdint.h>
+#include "flash.h"
+
+/* Sweep settings that are saved in flash and restored at boot.
+ *
+ * Settings are kept as arguments of the commands that set them up, so that
+ * restoring them goes through the same checks as a command from the host. */
+struct settings {
+	/* Arguments of the last "select channel" command. dev_id is -1 if
+	 * nothing is selected. */
+	int32_t dev_id;
+	int32_t config_id;
+	int32_t channel_start;
+	int32_t channel_step;
+	int32_t channel_stop;
+
+	/* Report mode and arguments of the "select" command that set it */
+	int32_t report_mode;
+	int32_t mode_arg[4];
+
+	int32_t keep_warm;
+	int32_t record;
+
+	/* Start reporting right after boot */
+	int32_t autostart;
+};
+
+/* Saved settings are appended to the page in slots. The slot with the valid
+ * magic at the highest offset holds the current settings. The magic is
+ * written after the settings, so a slot written only partially before a
+ * reset is ignored. The page is only erased when it has no free slots left. */
+struct settings_slot {
+	struct settings settings;
+	uint32_t magic;
+};
+
+/* The magic includes the layout version and size of struct settings, so that
+ * slots saved by firmware with a different layout are ignored. Increase
+ * SETTINGS_VERSION when the meaning of fields changes. */
+#define SETTINGS_VERSION	1
+
+#define SETTINGS_MAGIC		(0x53000000 | (SETTINGS_VERSION << 16) | \
+		(uint32_t) sizeof(struct settings))
+
+int settings_load(const struct flash_region* region, struct settings* settings);
+int settings_save(const struct flash_region* region, const struct settings* settings);
+
+#endif
@@ -19,11 +19,38 @@
 /* High-level interface to spectrum sensing hardware */
 
 #include <stdlib.h>
+#include <string.h>
+#include <libopencm3/cm3/scs.h>
+#include <libopencm3/stm32/f1/rtc.h>
+#include <libopencm3/stm32/iwdg.h>
+#include <libopencm3/stm32/systick.h>
+
 #include "spectrum.h"
+#include "noise-floor.h"
 
 int spectrum_dev_num = 0;
 const struct spectrum_dev* spectrum_dev_list[SPECTRUM_MAX_DEV];
 
+/* Device configuration currently applied to each device in spectrum_dev_list,
+ * or NULL if the device needs to be set up before the next scan. */
+static const struct spectrum_dev_config* spectrum_dev_applied[SPECTRUM_MAX_DEV];
+
+/* If set, devices are not put into standby between scans. */
+static int spectrum_keep_warm = 0;
+
+/* Device last tuned by spectrum_measure() and the channel it is tuned to. 
+ * NULL if unknown. */
+static const struct spectrum_dev* spectrum_tuned_dev = NULL;
+static int spectrum_tuned_ch;
+
+/* Busy-wait for usecs microseconds. Must be less than one SysTick period. */
+void systick_udelay(uint32_t usecs)
+{
+	uint32_t val = (STK_VAL - SYSTICK_TICKS_PER_US * usecs) 
+		& 0x00ffffff;
+	while(!((STK_VAL - val) & 0x00800000));
+}
+
 /* Register a new spectrum sensing device to the system */
 int spectrum_add_dev(const struct spectrum_dev* dev)
 {
@@ -41,6 +68,10 @@ int spectrum_add_dev(const struct spectrum_dev* dev)
 int spectrum_reset(void)
 {
 	int n;
+	for(n = 0; n < spectrum_dev_num; n++) {
+		spectrum_dev_applied[n] = NULL;
+	}
+
 	for(n = 0; n < spectrum_dev_num; n++) {
 		int r = spectrum_dev_list[n]->dev_reset(spectrum_dev_list[n]->priv);
 		if(r) return r;
@@ -49,6 +80,75 @@ int spectrum_reset(void)
 	return 0;
 }
 
+/* Leave devices powered between scans (keep_warm = 1) or put them into
+ * standby after each scan (keep_warm = 0, default). */
+void spectrum_set_keep_warm(int keep_warm)
+{
+	spectrum_keep_warm = keep_warm;
+
+	if(!keep_warm) {
+		int n;
+		for(n = 0; n < spectrum_dev_num; n++) {
+			const struct spectrum_dev* dev = spectrum_dev_list[n];
+			if(dev->dev_standby != NULL) {
+				dev->dev_standby(dev->priv);
+			}
+		}
+	}
+}
+
+static int spectrum_dev_id(const struct spectrum_dev* dev)
+{
+	int n;
+	for(n = 0; n < spectrum_dev_num; n++) {
+		if(spectrum_dev_list[n] == dev) return n;
+	}
+
+	return -1;
+}
+
+/* Prepare a device for a scan and reset the timestamp counter.
+ *
+ * dev_setup is only called if the device configuration differs from the
+ * one applied during the previous scan. */
+static int spectrum_setup(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config)
+{
+	int id = spectrum_dev_id(dev);
+
+	if(id < 0 || spectrum_dev_applied[id] != sweep_config->dev_config) {
+		if(id >= 0) spectrum_dev_applied[id] = NULL;
+
+		int r = dev->dev_setup(dev->priv, sweep_config);
+		if(r) return r;
+
+		if(id >= 0) spectrum_dev_applied[id] = sweep_config->dev_config;
+	}
+
+	spectrum_tuned_dev = NULL;
+
+	rtc_set_counter_val(0);
+
+	return E_SPECTRUM_OK;
+}
+
+/* Finish a scan that returned r. Device state is unknown after an error, so
+ * it will be set up again before the next scan. */
+static int spectrum_finish(const struct spectrum_dev* dev, int r)
+{
+	spectrum_tuned_dev = NULL;
+
+	if(r && r != E_SPECTRUM_STOP_SWEEP) {
+		int id = spectrum_dev_id(dev);
+		if(id >= 0) spectrum_dev_applied[id] = NULL;
+	}
+
+	if(!spectrum_keep_warm && dev->dev_standby != NULL) {
+		dev->dev_standby(dev->priv);
+	}
+
+	return r;
+}
+
 /* Return number of channels for a sweep config. */
 int spectrum_sweep_channel_num(const struct spectrum_sweep_config* sweep_config)
 {
@@ -56,27 +156,719 @@ int spectrum_sweep_channel_num(const struct spectrum_sweep_config* sweep_config)
 		/ sweep_config->channel_step + 1;
 }
 
+static int spectrum_check_sweep_config(const struct spectrum_sweep_config* sweep_config)
+{
+	if (sweep_config->channel_step <= 0 || sweep_config->channel_start < 0) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (sweep_config->channel_start >= sweep_config->channel_stop) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (sweep_config->channel_stop > sweep_config->dev_config->channel_num) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+/* Return time in ms since the start of the scan. */
+static int spectrum_timestamp(void)
+{
+	uint32_t rtc_counter = rtc_get_counter_val();
+	/* LSE clock is 32768 Hz. Prescaler is set to 16.
+	 *
+	 *                 rtc_counter * 16
+	 * t [ms] = 1000 * ----------------
+	 *                       32768
+	 */
+	return ((long long) rtc_counter) * 1000 / 2048;
+}
+
+/* Tune device to channel ch, unless it is already tuned there.
+ *
+ * Sweeps tune to the next channel before passing results to a callback, so
+ * that the device settles while the results are being processed. */
+static int spectrum_tune(const struct spectrum_dev* dev,
+		const struct spectrum_sweep_config* sweep_config, int ch)
+{
+	if(spectrum_tuned_dev == dev && spectrum_tuned_ch == ch) {
+		return E_SPECTRUM_OK;
+	}
+
+	spectrum_tuned_dev = NULL;
+
+	int r = dev->dev_tune(dev->priv, sweep_config, ch);
+	if(r) return r;
+
+	spectrum_tuned_dev = dev;
+	spectrum_tuned_ch = ch;
+
+	return E_SPECTRUM_OK;
+}
+
+/* Measure channels from start to stop on a device that has already been set
+ * up and store measurements into data.
+ *
+ * Return 0 on success, or error code otherwise. */
+static int spectrum_measure(const struct spectrum_dev* dev, 
+		const struct spectrum_sweep_config* sweep_config,
+		int start, int step, int stop, short int data[])
+{
+	int r, ch, n;
+	for(ch = start, n = 0; ch < stop; ch += step, n++) {
+		IWDG_KR = IWDG_KR_RESET;
+
+		r = spectrum_tune(dev, sweep_config, ch);
+		if(r) return r;
+
+		r = dev->dev_read_measure(dev->priv, sweep_config, &data[n]);
+		if(r) return r;
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+/* DWT cycle counter runs from core clock (48 MHz) */
+#define SPECTRUM_CYCLES_PER_US	48
+
+/* Enable DWT cycle counter */
+static void spectrum_cycle_counter_enable(void)
+{
+	SCS_DEMCR |= SCS_DEMCR_TRCENA;
+	SCS_DWT_CTRL |= SCS_DWT_CTRL_CYCCNTENA;
+}
+
+/* Measure time needed for device setup and time per channel for a device
+ * configuration. Setup is always done from scratch, even if the
+ * configuration is already applied. Up to SPECTRUM_BENCH_CHANNEL_NUM channels
+ * from the start of the band are measured.
+ *
+ * Return 0 on success, or error code otherwise. */
+int spectrum_bench(const struct spectrum_dev* dev, const struct spectrum_dev_config* dev_config,
+		struct spectrum_bench_result* result)
+{
+	short int data[SPECTRUM_BENCH_CHANNEL_NUM];
+
+	struct spectrum_sweep_config sweep_config = {
+		.dev_config = dev_config,
+		.channel_start = 0,
+		.channel_step = 1,
+		.channel_stop = dev_config->channel_num
+	};
+
+	if(sweep_config.channel_stop > SPECTRUM_BENCH_CHANNEL_NUM) {
+		sweep_config.channel_stop = SPECTRUM_BENCH_CHANNEL_NUM;
+	}
+
+	int r = spectrum_check_sweep_config(&sweep_config);
+	if(r) return r;
+
+	spectrum_cycle_counter_enable();
+
+	int id = spectrum_dev_id(dev);
+	if(id >= 0) spectrum_dev_applied[id] = NULL;
+
+	IWDG_KR = IWDG_KR_RESET;
+
+	uint32_t start = SCS_DWT_CYCCNT;
+
+	r = spectrum_setup(dev, &sweep_config);
+	if(!r) {
+		uint32_t setup_cycles = SCS_DWT_CYCCNT - start;
+
+		start = SCS_DWT_CYCCNT;
+
+		r = spectrum_measure(dev, &sweep_config, sweep_config.channel_start,
+				sweep_config.channel_step, sweep_config.channel_stop, data);
+
+		uint32_t measure_cycles = SCS_DWT_CYCCNT - start;
+
+		result->setup_us = setup_cycles / SPECTRUM_CYCLES_PER_US;
+		result->channel_us = measure_cycles / SPECTRUM_CYCLES_PER_US
+			/ spectrum_sweep_channel_num(&sweep_config);
+	}
+
+	return spectrum_finish(dev, r);
+}
+
 /* Start a spectrum sensing on a device 
  *
  * Return 0 on success, or error code otherwise. */
 int spectrum_run(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config)
 {
 	/* some sanity checks */
-	if (sweep_config->channel_start >= sweep_config->channel_stop) {
+	int r = spectrum_check_sweep_config(sweep_config);
+	if(r) return r;
+
+	if (sweep_config->cb == NULL) {
 		return E_SPECTRUM_INVALID;
 	}
 
-	if (sweep_config->channel_stop > sweep_config->dev_config->channel_num) {
+	short int* data = calloc(spectrum_sweep_channel_num(sweep_config), sizeof(*data));
+	if (data == NULL) {
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	r = spectrum_setup(dev, sweep_config);
+
+	while(!r) {
+		int timestamp = spectrum_timestamp();
+
+		r = spectrum_measure(dev, sweep_config,
+				sweep_config->channel_start,
+				sweep_config->channel_step,
+				sweep_config->channel_stop,
+				data);
+		if(r) break;
+
+		r = spectrum_tune(dev, sweep_config, sweep_config->channel_start);
+		if(r) break;
+
+		r = sweep_config->cb(sweep_config, timestamp, data);
+	}
+
+	r = spectrum_finish(dev, r);
+
+	free(data);
+
+	if (r == E_SPECTRUM_STOP_SWEEP) {
+		return E_SPECTRUM_OK;
+	} else {
+		return r;
+	}
+}
+
+/* Insert measurement n into a list of strongest measurements, sorted by
+ * descending power and holding at most peak_num entries.
+ *
+ * Return new length of the list. */
+static int zoom_add_peak(int peak_list[], int peak_len, int peak_num, 
+		const short int data[], int n)
+{
+	int i;
+	if(peak_len < peak_num) {
+		i = peak_len;
+		peak_len++;
+	} else if(data[peak_list[peak_len - 1]] < data[n]) {
+		i = peak_len - 1;
+	} else {
+		return peak_len;
+	}
+
+	for(; i > 0 && data[peak_list[i - 1]] < data[n]; i--) {
+		peak_list[i] = peak_list[i - 1];
+	}
+	peak_list[i] = n;
+
+	return peak_len;
+}
+
+/* First channel of the fine pass window around channel ch. Windows are aligned
+ * to a common grid, so that overlapping windows can be merged. */
+static int zoom_window_start(const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_zoom_config* zoom_config, int ch)
+{
+	int start = ch - zoom_config->fine_window;
+	if(start < sweep_config->channel_start) {
+		start = sweep_config->channel_start;
+	}
+
+	return sweep_config->channel_start + 
+		(start - sweep_config->channel_start) / zoom_config->fine_step * zoom_config->fine_step;
+}
+
+/* Channel after the last channel of the fine pass window around channel ch. */
+static int zoom_window_stop(const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_zoom_config* zoom_config, int ch)
+{
+	int stop = ch + zoom_config->fine_window + 1;
+	if(stop > sweep_config->channel_stop) {
+		stop = sweep_config->channel_stop;
+	}
+
+	return stop;
+}
+
+/* Do the coarse and fine pass of an adaptive sweep. Store fine pass
+ * measurements into point_list.
+ *
+ * Return 0 on success, or error code otherwise. */
+static int zoom_sweep(const struct spectrum_dev* dev,
+		const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_zoom_config* zoom_config,
+		short int coarse_data[], short int fine_data[],
+		struct spectrum_point point_list[], int* point_num, int* timestamp)
+{
+	*timestamp = spectrum_timestamp();
+
+	int r = spectrum_measure(dev, sweep_config,
+			sweep_config->channel_start,
+			sweep_config->channel_step,
+			sweep_config->channel_stop,
+			coarse_data);
+	if(r) return r;
+
+	int peak_list[SPECTRUM_ZOOM_MAX_PEAKS];
+	int peak_len = 0;
+
+	int n, i;
+	int coarse_num = spectrum_sweep_channel_num(sweep_config);
+	for(n = 0; n < coarse_num; n++) {
+		if(coarse_data[n] > zoom_config->threshold) {
+			peak_len = zoom_add_peak(peak_list, peak_len, 
+					zoom_config->peak_num, coarse_data, n);
+		}
+	}
+
+	/* order detections by channel */
+	for(i = 0; i < peak_len; i++) {
+		int ch = sweep_config->channel_start + peak_list[i] * sweep_config->channel_step;
+		for(n = i; n > 0 && peak_list[n - 1] > ch; n--) {
+			peak_list[n] = peak_list[n - 1];
+		}
+		peak_list[n] = ch;
+	}
+
+	*point_num = 0;
+
+	i = 0;
+	while(i < peak_len) {
+		int start = zoom_window_start(sweep_config, zoom_config, peak_list[i]);
+		int stop = zoom_window_stop(sweep_config, zoom_config, peak_list[i]);
+
+		/* merge overlapping windows */
+		for(i++; i < peak_len; i++) {
+			if(zoom_window_start(sweep_config, zoom_config, peak_list[i]) > stop) break;
+			stop = zoom_window_stop(sweep_config, zoom_config, peak_list[i]);
+		}
+
+		r = spectrum_measure(dev, sweep_config,
+				start, zoom_config->fine_step, stop,
+				fine_data);
+		if(r) return r;
+
+		int ch;
+		for(ch = start, n = 0; ch < stop; ch += zoom_config->fine_step, n++) {
+			point_list[*point_num].channel = ch;
+			point_list[*point_num].data = fine_data[n];
+			(*point_num)++;
+		}
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+/* Start an adaptive spectrum sensing on a device
+ *
+ * Return 0 on success, or error code otherwise. */
+int spectrum_run_zoom(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_zoom_config* zoom_config)
+{
+	/* some sanity checks */
+	int r = spectrum_check_sweep_config(sweep_config);
+	if(r) return r;
+
+	if (zoom_config->fine_step <= 0 || zoom_config->fine_window < 0) {
 		return E_SPECTRUM_INVALID;
 	}
 
-	if (sweep_config->cb == NULL) {
+	if (zoom_config->peak_num <= 0 || zoom_config->peak_num > SPECTRUM_ZOOM_MAX_PEAKS) {
 		return E_SPECTRUM_INVALID;
 	}
 
-	int r = dev->dev_setup(dev->priv, sweep_config);
+	if (zoom_config->cb == NULL) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	/* upper bound on the number of fine pass measurements */
+	int point_max = zoom_config->peak_num * ((2 * zoom_config->fine_window + 
+				zoom_config->fine_step) / zoom_config->fine_step + 1);
+
+	short int* coarse_data = calloc(spectrum_sweep_channel_num(sweep_config), 
+			sizeof(*coarse_data));
+	short int* fine_data = calloc(point_max, sizeof(*fine_data));
+	struct spectrum_point* point_list = calloc(point_max, sizeof(*point_list));
+
+	if (coarse_data == NULL || fine_data == NULL || point_list == NULL) {
+		r = E_SPECTRUM_TOOMANY;
+	} else {
+		r = spectrum_setup(dev, sweep_config);
+	}
+
+	while(!r) {
+		int point_num, timestamp;
+		r = zoom_sweep(dev, sweep_config, zoom_config, 
+				coarse_data, fine_data, point_list, 
+				&point_num, &timestamp);
+		if(r) break;
+
+		r = spectrum_tune(dev, sweep_config, sweep_config->channel_start);
+		if(r) break;
+
+		r = zoom_config->cb(sweep_config, timestamp, point_list, point_num);
+	}
+
+	r = spectrum_finish(dev, r);
+
+	free(coarse_data);
+	free(fine_data);
+	free(point_list);
+
+	if (r == E_SPECTRUM_STOP_SWEEP) {
+		return E_SPECTRUM_OK;
+	} else {
+		return r;
+	}
+}
+
+/* Per-channel state of the revisit scheduler */
+struct schedule_channel {
+	/* Number of the measurement when this channel was last visited */
+	int last;
+
+	/* Activity score in 0.01 dB above noise floor */
+	int score;
+};
+
+/* Noise floor percentile and adaptation step used for activity scores */
+#define SCHEDULE_FLOOR_PERCENTILE	10
+#define SCHEDULE_FLOOR_STEP		10
+
+/* Priority offset of a channel with no activity, in units of the score */
+#define SCHEDULE_IDLE_PRIORITY	100
+
+/* Pick a channel to visit with the measurement number t. */
+static int schedule_pick(const struct schedule_channel channel_list[], int channel_num, 
+		int t, int revisit_max)
+{
+	int n;
+	int n_max = 0;
+	long long int p_max = -1;
+
+	/* overdue channels first, oldest first */
+	for(n = 0; n < channel_num; n++) {
+		int age = t - channel_list[n].last;
+		if(age >= revisit_max && age > p_max) {
+			p_max = age;
+			n_max = n;
+		}
+	}
+
+	if(p_max >= 0) return n_max;
+
+	for(n = 0; n < channel_num; n++) {
+		int age = t - channel_list[n].last;
+		long long int p = ((long long int) age) * 
+			(SCHEDULE_IDLE_PRIORITY + channel_list[n].score);
+		if(p > p_max) {
+			p_max = p;
+			n_max = n;
+		}
+	}
+
+	return n_max;
+}
+
+static void schedule_update(struct schedule_channel* channel, short int data, short int floor)
+{
+	int activity = data - floor;
+	if(activity < 0) {
+		activity = 0;
+	}
+
+	channel->score += (activity - channel->score) / 4;
+}
+
+/* Start an activity-weighted spectrum sensing on a device
+ *
+ * Return 0 on success, or error code otherwise. */
+int spectrum_run_schedule(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_schedule_config* schedule_config)
+{
+	/* some sanity checks */
+	int r = spectrum_check_sweep_config(sweep_config);
 	if(r) return r;
 
-	r = dev->dev_run(dev->priv, sweep_config);
-	return r;
+	int channel_num = spectrum_sweep_channel_num(sweep_config);
+
+	if (schedule_config->revisit_max < channel_num) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (schedule_config->cb == NULL) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	struct noise_floor nf = { .est = NULL, .n = NULL };
+	r = noise_floor_init(&nf, channel_num, 
+			SCHEDULE_FLOOR_PERCENTILE, SCHEDULE_FLOOR_STEP);
+	if(r) return r;
+
+	struct schedule_channel* channel_list = calloc(channel_num, sizeof(*channel_list));
+	if (channel_list == NULL) {
+		noise_floor_free(&nf);
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	/* visit all channels in order on the first pass */
+	int n;
+	for(n = 0; n < channel_num; n++) {
+		channel_list[n].last = n - channel_num;
+	}
+
+	r = spectrum_setup(dev, sweep_config);
+
+	int t;
+	n = schedule_pick(channel_list, channel_num, 0, schedule_config->revisit_max);
+	for(t = 0; !r; t++) {
+		struct spectrum_point point;
+		point.channel = sweep_config->channel_start + n * sweep_config->channel_step;
+
+		int timestamp = spectrum_timestamp();
+		r = spectrum_measure(dev, sweep_config,
+				point.channel, 1, point.channel + 1,
+				&point.data);
+		if(r) break;
+
+		noise_floor_update_channel(&nf, n, point.data);
+		schedule_update(&channel_list[n], point.data, noise_floor_get(&nf, n));
+		channel_list[n].last = t;
+
+		/* next channel to visit only depends on state updated above */
+		n = schedule_pick(channel_list, channel_num, t + 1, schedule_config->revisit_max);
+		r = spectrum_tune(dev, sweep_config,
+				sweep_config->channel_start + n * sweep_config->channel_step);
+		if(r) break;
+
+		r = schedule_config->cb(sweep_config, timestamp, &point, 1);
+	}
+
+	r = spectrum_finish(dev, r);
+
+	free(channel_list);
+	noise_floor_free(&nf);
+
+	if (r == E_SPECTRUM_STOP_SWEEP) {
+		return E_SPECTRUM_OK;
+	} else {
+		return r;
+	}
+}
+
+/* Check all channels in a sweep for a carrier and store packed occupancy
+ * bits into occupancy.
+ *
+ * Return 0 on success, or error code otherwise. */
+static int spectrum_measure_occupancy(const struct spectrum_dev* dev,
+		const struct spectrum_sweep_config* sweep_config,
+		unsigned char occupancy[], int occupancy_len)
+{
+	memset(occupancy, 0, occupancy_len);
+
+	int r, ch, n;
+	for(		ch = sweep_config->channel_start, n = 0;
+			ch < sweep_config->channel_stop;
+			ch += sweep_config->channel_step, n++) {
+		IWDG_KR = IWDG_KR_RESET;
+
+		r = spectrum_tune(dev, sweep_config, ch);
+		if(r) return r;
+
+		int busy;
+		r = dev->dev_read_occupancy(dev->priv, sweep_config, &busy);
+		if(r) return r;
+
+		if(busy) {
+			occupancy[n/8] |= 1 << (n%8);
+		}
+	}
+
+	return E_SPECTRUM_OK;
+}
+
+/* Start binary occupancy sweep on a device
+ *
+ * Return 0 on success, or error code otherwise. */
+int spectrum_run_occupancy(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_occupancy_config* occupancy_config)
+{
+	/* some sanity checks */
+	if (dev->dev_occupancy_start == NULL || dev->dev_read_occupancy == NULL ||
+			dev->dev_occupancy_stop == NULL) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	int r = spectrum_check_sweep_config(sweep_config);
+	if(r) return r;
+
+	if (occupancy_config->cb == NULL) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	int occupancy_len = (spectrum_sweep_channel_num(sweep_config) + 7) / 8;
+	unsigned char* occupancy = malloc(occupancy_len);
+	if (occupancy == NULL) {
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	r = spectrum_setup(dev, sweep_config);
+	if(!r) {
+		r = dev->dev_occupancy_start(dev->priv, sweep_config, occupancy_config);
+	}
+
+	if(!r) {
+		do {
+			int timestamp = spectrum_timestamp();
+
+			r = spectrum_measure_occupancy(dev, sweep_config,
+					occupancy, occupancy_len);
+			if(r) break;
+
+			r = spectrum_tune(dev, sweep_config, sweep_config->channel_start);
+			if(r) break;
+
+			r = occupancy_config->cb(sweep_config, timestamp, occupancy);
+		} while(!r);
+
+		dev->dev_occupancy_stop(dev->priv, sweep_config);
+	}
+
+	r = spectrum_finish(dev, r);
+
+	free(occupancy);
+
+	if (r == E_SPECTRUM_STOP_SWEEP) {
+		return E_SPECTRUM_OK;
+	} else {
+		return r;
+	}
+}
+
+/* Time in SysTick ticks. Must be called at least once per SysTick period
+ * (approx. 2.8 s) to catch all counter wrap-arounds. */
+static unsigned long long int systick_ticks;
+static uint32_t systick_last;
+
+static void systick_clock_start(void)
+{
+	systick_set_reload(0x00ffffff);
+	systick_set_clocksource(STK_CTRL_CLKSOURCE_AHB_DIV8);
+	systick_counter_enable();
+
+	systick_ticks = 0;
+	systick_last = STK_VAL;
+}
+
+static unsigned long long int systick_clock(void)
+{
+	uint32_t val = STK_VAL;
+
+	/* SysTick counts down */
+	systick_ticks += (systick_last - val) & 0x00ffffff;
+	systick_last = val;
+
+	return systick_ticks;
+}
+
+/* Start zero-span measurement on a device
+ *
+ * Return 0 on success, or error code otherwise. */
+int spectrum_run_zero_span(const struct spectrum_dev* dev, 
+		const struct spectrum_zero_span_config* zero_span_config)
+{
+	/* some sanity checks */
+	if (dev->dev_zero_span_start == NULL || dev->dev_zero_span_sample == NULL ||
+			dev->dev_zero_span_stop == NULL) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (zero_span_config->channel < 0 || 
+			zero_span_config->channel >= zero_span_config->dev_config->channel_num) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (zero_span_config->interval_us <= 0 || 
+			zero_span_config->interval_us > SPECTRUM_ZERO_SPAN_MAX_INTERVAL_US) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (zero_span_config->block_len <= 0 ||
+			zero_span_config->block_len > SPECTRUM_ZERO_SPAN_MAX_BLOCK_LEN ||
+			(long long int) zero_span_config->block_len * zero_span_config->interval_us >
+				SPECTRUM_ZERO_SPAN_MAX_BLOCK_US) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (zero_span_config->cb == NULL) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	short int* data = calloc(zero_span_config->block_len, sizeof(*data));
+	if (data == NULL) {
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	/* device setup only depends on the device configuration */
+	struct spectrum_sweep_config sweep_config = {
+		.dev_config		= zero_span_config->dev_config,
+		.channel_start		= zero_span_config->channel,
+		.channel_step		= 1,
+		.channel_stop		= zero_span_config->channel + 1,
+		.cb			= NULL
+	};
+
+	int r = spectrum_setup(dev, &sweep_config);
+	if (r) {
+		free(data);
+		return spectrum_finish(dev, r);
+	}
+
+	r = dev->dev_zero_span_start(dev->priv, zero_span_config);
+	if (r) {
+		free(data);
+		return spectrum_finish(dev, r);
+	}
+
+	const unsigned long long int period = zero_span_config->interval_us * SYSTICK_TICKS_PER_US;
+
+	systick_clock_start();
+
+	while(!r) {
+		unsigned long long int t = systick_clock();
+		unsigned long long int timestamp_us = t / SYSTICK_TICKS_PER_US;
+
+		int n;
+		for(n = 0; n < zero_span_config->block_len; n++) {
+			IWDG_KR = IWDG_KR_RESET;
+
+			while(systick_clock() < t);
+			t += period;
+
+			r = dev->dev_zero_span_sample(dev->priv, zero_span_config, &data[n]);
+			if(r) break;
+
+			/* sample overran into the next one, which would start late */
+			if(systick_clock() > t) {
+				r = E_SPECTRUM_OVERRUN;
+				break;
+			}
+		}
+		if(r) break;
+
+		r = zero_span_config->cb(zero_span_config, timestamp_us, data);
+	}
+
+	dev->dev_zero_span_stop(dev->priv, zero_span_config);
+
+	r = spectrum_finish(dev, r);
+
+	free(data);
+
+	if (r == E_SPECTRUM_STOP_SWEEP) {
+		return E_SPECTRUM_OK;
+	} else {
+		return r;
+	}
 }
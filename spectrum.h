@@ -18,6 +18,8 @@
 #ifndef HAVE_SPECTRUM_H
 #define HAVE_SPECTRUM_H
 
+#include <stdint.h>
+
 struct spectrum_sweep_config;
 
 /* Return 0 to continue sweep, E_SPECTRUM_STOP_SWEEP to stop sweep and return from
@@ -45,6 +47,32 @@ typedef int (*spectrum_cb_t)(
 		 */
 		const short int data_list[]);
 
+/* Single measurement in a sparse list of measurements. */
+struct spectrum_point {
+	/* Channel of the measurement */
+	int channel;
+
+	/* Input power in 0.01 dBm */
+	short int data;
+};
+
+/* Return 0 to continue, E_SPECTRUM_STOP_SWEEP to stop and return from
+ * spectrum_run_zoom or spectrum_run_schedule or any other value on error. */
+typedef int (*spectrum_sparse_cb_t)(
+		/* Pointer to the sweep_config struct passed to spectrum_run_zoom or
+		 * spectrum_run_schedule */
+		const struct spectrum_sweep_config* sweep_config,
+
+		/* Timestamp of the measurement in ms since spectrum_run_zoom or
+		 * spectrum_run_schedule call */
+		int timestamp,
+
+		/* Array of measurements, ordered by channel */
+		const struct spectrum_point point_list[],
+
+		/* Number of measurements in point_list */
+		int point_num);
+
 struct spectrum_sweep_config {
 	/* Device configuration Pre-set to use */
 	const struct spectrum_dev_config *dev_config;
@@ -62,6 +90,125 @@ struct spectrum_sweep_config {
 	spectrum_cb_t cb;
 };
 
+/* Adaptive two-pass sweep.
+ *
+ * A coarse pass measures channels as given by the spectrum_sweep_config.
+ * Channels with power above threshold are detections. For up to peak_num
+ * strongest detections, a fine pass then measures channels in a window
+ * around each detection:
+ *
+ * c - fine_window <= m <= c + fine_window
+ *
+ * stepping fine_step channels at a time. Overlapping windows are merged. */
+struct spectrum_zoom_config {
+	/* Increment in channel number between two measurements in the fine pass */
+	int fine_step;
+
+	/* Half-width of the fine pass window in channels */
+	int fine_window;
+
+	/* Detection threshold in 0.01 dBm */
+	int threshold;
+
+	/* Maximum number of detections to zoom into for each sweep */
+	int peak_num;
+
+	/* Callback function, called with fine pass measurements */
+	spectrum_sparse_cb_t cb;
+};
+
+/* Activity-weighted channel revisit schedule.
+ *
+ * Channels given by the spectrum_sweep_config are measured one at a time.
+ * For each channel an activity score is kept (moving average of power above
+ * the channel noise floor, see noise-floor.h). Channels with a higher score
+ * are revisited more often, but each channel is measured at least once every
+ * revisit_max measurements. */
+struct spectrum_schedule_config {
+	/* Maximum number of measurements between two visits of a channel. Must
+	 * not be less than the number of channels in the sweep. */
+	int revisit_max;
+
+	/* Callback function, called with each measurement */
+	spectrum_sparse_cb_t cb;
+};
+
+/* Return 0 to continue, E_SPECTRUM_STOP_SWEEP to stop and return from
+ * spectrum_run_occupancy or any other value on error. */
+typedef int (*spectrum_occupancy_cb_t)(
+		/* Pointer to the sweep_config struct passed to spectrum_run_occupancy */
+		const struct spectrum_sweep_config* sweep_config,
+
+		/* Timestamp of the sweep in ms since spectrum_run_occupancy call */
+		int timestamp,
+
+		/* Packed occupancy bits, one per channel
+		 *
+		 * (occupancy[n/8] >> (n%8)) & 1 = 1 if channel m was busy, where
+		 *
+		 * m = channel_start + channel_step * n
+		 *
+		 * n = 0 .. channel_num - 1 */
+		const unsigned char occupancy[]);
+
+/* Binary occupancy sweep.
+ *
+ * Channels given by the spectrum_sweep_config are only checked for
+ * presence of a carrier. This is much faster than measuring power, but the 
+ * result is only a busy/idle decision for each channel. */
+struct spectrum_occupancy_config {
+	/* Carrier sense threshold in dB. Meaning is device specific. */
+	int threshold;
+
+	/* Callback function, called after each sweep */
+	spectrum_occupancy_cb_t cb;
+};
+
+struct spectrum_zero_span_config;
+
+/* Return 0 to continue, E_SPECTRUM_STOP_SWEEP to stop and return from
+ * spectrum_run_zero_span or any other value on error. */
+typedef int (*spectrum_block_cb_t)(
+		/* Pointer to the zero_span_config struct passed to spectrum_run_zero_span */
+		const struct spectrum_zero_span_config* zero_span_config,
+
+		/* Time of the first sample in the block in microseconds since 
+		 * spectrum_run_zero_span call */
+		unsigned long long int timestamp_us,
+
+		/* Array of samples
+		 *
+		 * data[n] = sample taken at timestamp_us + n * interval_us
+		 *
+		 * n = 0 .. block_len - 1
+		 *
+		 * Values are input power in 0.01 dBm */
+		const short int data_list[]);
+
+/* Zero-span (time-domain) measurement.
+ *
+ * The device is tuned once and power on a single channel is then sampled at
+ * a fixed interval. Samples are passed to the callback in blocks. Sampling
+ * is paused while the callback runs, but samples within a block are always 
+ * exactly interval_us apart. If taking a sample takes longer than
+ * interval_us, the measurement stops with E_SPECTRUM_OVERRUN. */
+struct spectrum_zero_span_config {
+	/* Device configuration Pre-set to use */
+	const struct spectrum_dev_config *dev_config;
+
+	/* Channel to sample */
+	int channel;
+
+	/* Time between two samples in microseconds */
+	int interval_us;
+
+	/* Number of samples in a block */
+	int block_len;
+
+	/* Callback function */
+	spectrum_block_cb_t cb;
+};
+
 /* Configuration pre-set for a spectrum sensing device.
  *
  * f_cmin = channel_base
@@ -96,9 +243,31 @@ struct spectrum_dev_config {
 	void* priv;
 };
 
+/* Measured timing of a device configuration */
+struct spectrum_bench_result {
+	/* Time required for device setup in microseconds */
+	uint32_t setup_us;
+
+	/* Time required for detection per channel in microseconds,
+	 * including tuning */
+	uint32_t channel_us;
+};
+
 typedef int (*spectrum_dev_reset_t)(void* priv);
 typedef int (*spectrum_dev_setup_t)(void* priv, const struct spectrum_sweep_config* sweep_config);
-typedef int (*spectrum_dev_run_t)(void* priv, const struct spectrum_sweep_config* sweep_config);
+typedef int (*spectrum_dev_tune_t)(void* priv, const struct spectrum_sweep_config* sweep_config, int channel);
+typedef int (*spectrum_dev_read_measure_t)(void* priv, const struct spectrum_sweep_config* sweep_config,
+		short int* data);
+typedef int (*spectrum_dev_standby_t)(void* priv);
+typedef int (*spectrum_dev_occupancy_start_t)(void* priv, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_occupancy_config* occupancy_config);
+typedef int (*spectrum_dev_read_occupancy_t)(void* priv, const struct spectrum_sweep_config* sweep_config,
+		int* busy);
+typedef int (*spectrum_dev_occupancy_stop_t)(void* priv, const struct spectrum_sweep_config* sweep_config);
+typedef int (*spectrum_dev_zero_span_start_t)(void* priv, const struct spectrum_zero_span_config* zero_span_config);
+typedef int (*spectrum_dev_zero_span_sample_t)(void* priv, const struct spectrum_zero_span_config* zero_span_config,
+		short int* data);
+typedef int (*spectrum_dev_zero_span_stop_t)(void* priv, const struct spectrum_zero_span_config* zero_span_config);
 
 struct spectrum_dev {
 	/* Name of the device */
@@ -114,8 +283,38 @@ struct spectrum_dev {
 	/* Setup a spectrum sensing scan */
 	spectrum_dev_setup_t dev_setup;
 
-	/* Start a spectrum sensing scan */
-	spectrum_dev_run_t dev_run;
+	/* Tune to a channel. Should return as soon as possible - waiting for
+	 * the device to settle should be left to dev_read_measure. */
+	spectrum_dev_tune_t dev_tune;
+
+	/* Wait for the measurement on the current channel to finish and return
+	 * input power in 0.01 dBm. May be called several times after one 
+	 * dev_tune. */
+	spectrum_dev_read_measure_t dev_read_measure;
+
+	/* Put the device into low power mode after a scan (optional). Device
+	 * must keep the settings applied by dev_setup. */
+	spectrum_dev_standby_t dev_standby;
+
+	/* Prepare for a binary occupancy scan (optional) */
+	spectrum_dev_occupancy_start_t dev_occupancy_start;
+
+	/* Wait for carrier sense on the current channel to become valid and
+	 * set busy to 1 if a carrier is present, 0 otherwise */
+	spectrum_dev_read_occupancy_t dev_read_occupancy;
+
+	/* Finish binary occupancy scan. Device must keep the settings applied
+	 * by dev_setup. */
+	spectrum_dev_occupancy_stop_t dev_occupancy_stop;
+
+	/* Tune to a channel for zero-span measurement (optional) */
+	spectrum_dev_zero_span_start_t dev_zero_span_start;
+
+	/* Take a single zero-span sample. Should return as soon as possible */
+	spectrum_dev_zero_span_sample_t dev_zero_span_sample;
+
+	/* Finish zero-span measurement */
+	spectrum_dev_zero_span_stop_t dev_zero_span_stop;
 
 	/* Opaque pointer to a device-specific data structure */
 	void* priv;
@@ -125,14 +324,49 @@ struct spectrum_dev {
 #define E_SPECTRUM_OK 0
 #define E_SPECTRUM_INVALID -1
 #define E_SPECTRUM_TOOMANY -2
+#define E_SPECTRUM_TIMEOUT -3
+#define E_SPECTRUM_IO -4
+#define E_SPECTRUM_OVERRUN -5
 
 #define SPECTRUM_MAX_DEV 10
+#define SPECTRUM_ZOOM_MAX_PEAKS 16
+
+/* Number of channels measured by spectrum_bench() */
+#define SPECTRUM_BENCH_CHANNEL_NUM 16
+
+/* Maximum time between two zero-span samples */
+#define SPECTRUM_ZERO_SPAN_MAX_INTERVAL_US 1000000
+
+/* Maximum number of samples in a zero-span block. A block must be sent out
+ * over the serial line well within the SysTick period (approx. 2.8 s). */
+#define SPECTRUM_ZERO_SPAN_MAX_BLOCK_LEN 4096
+
+/* Maximum time covered by one zero-span block. Stop requests are only checked
+ * between blocks. */
+#define SPECTRUM_ZERO_SPAN_MAX_BLOCK_US 1000000
+
+/* SysTick runs from AHB clock (48 MHz) divided by 8. Drivers using
+ * systick_udelay() must set up SysTick this way. */
+#define SYSTICK_TICKS_PER_US	6
 
 extern int spectrum_dev_num;
 extern const struct spectrum_dev* spectrum_dev_list[];
 
+void systick_udelay(uint32_t usecs);
+
 int spectrum_add_dev(const struct spectrum_dev* dev);
 int spectrum_reset(void);
+void spectrum_set_keep_warm(int keep_warm);
 int spectrum_sweep_channel_num(const struct spectrum_sweep_config* sweep_config);
 int spectrum_run(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config);
+int spectrum_bench(const struct spectrum_dev* dev, const struct spectrum_dev_config* dev_config,
+		struct spectrum_bench_result* result);
+int spectrum_run_zoom(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_zoom_config* zoom_config);
+int spectrum_run_schedule(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_schedule_config* schedule_config);
+int spectrum_run_occupancy(const struct spectrum_dev* dev, const struct spectrum_sweep_config* sweep_config,
+		const struct spectrum_occupancy_config* occupancy_config);
+int spectrum_run_zero_span(const struct spectrum_dev* dev, 
+		const struct spectrum_zero_span_config* zero_span_config);
 #endif
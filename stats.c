@@ -0,0 +1,105 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+
+/* Per-channel power histograms and duty-cycle counters */
+
+#include <stdlib.h>
+#include "spectrum.h"
+#include "stats.h"
+
+/* Allocate and clear statistics for a sweep.
+ *
+ * Return 0 on success, or error code otherwise. */
+int stats_init(struct stats* stats, const struct stats_config* config)
+{
+	stats_free(stats);
+
+	if (config->channel_num <= 0 || config->bin_num <= 0 || config->bin_width <= 0) {
+		return E_SPECTRUM_INVALID;
+	}
+
+	if (config->bin_num > STATS_BIN_MAX ||
+			config->channel_num > STATS_HIST_MAX / config->bin_num) {
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	stats->above = calloc(config->channel_num, sizeof(*stats->above));
+	stats->hist = calloc(config->channel_num * config->bin_num, sizeof(*stats->hist));
+
+	if (stats->above == NULL || stats->hist == NULL) {
+		stats_free(stats);
+		return E_SPECTRUM_TOOMANY;
+	}
+
+	stats->config = *config;
+	stats->sweep_num = 0;
+
+	return E_SPECTRUM_OK;
+}
+
+void stats_free(struct stats* stats)
+{
+	free(stats->above);
+	free(stats->hist);
+
+	stats->above = NULL;
+	stats->hist = NULL;
+	stats->sweep_num = 0;
+}
+
+static int stats_get_bin(const struct stats_config* config, short int data)
+{
+	if (data < config->bin_min) {
+		return 0;
+	}
+
+	int n = (data - config->bin_min) / config->bin_width;
+	if (n >= config->bin_num) {
+		return config->bin_num - 1;
+	} else {
+		return n;
+	}
+}
+
+/* Add measurements from one sweep. */
+void stats_update(struct stats* stats, const short int data_list[])
+{
+	const struct stats_config* config = &stats->config;
+
+	if (stats->hist == NULL) return;
+
+	int m;
+	for(m = 0; m < config->channel_num; m++) {
+		uint16_t* hist = &stats->hist[m * config->bin_num];
+		int n = stats_get_bin(config, data_list[m]);
+
+		if (hist[n] == UINT16_MAX) {
+			int i;
+			for(i = 0; i < config->bin_num; i++) {
+				hist[i] /= 2;
+			}
+		}
+		hist[n]++;
+
+		if (data_list[m] > config->threshold) {
+			stats->above[m]++;
+		}
+	}
+
+	stats->sweep_num++;
+}
@@ -0,0 +1,81 @@
+/* Copyright (C) 2026 SensorLab, Jozef Stefan Institute
+ * http://sensorlab.ijs.si
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Author: agent, <agent@local> */
+#ifndef HAVE_STATS_H
+#define HAVE_STATS_H
+
+#include <stdint.h>
+
+/* Per-channel occupancy statistics.
+ *
+ * For each channel in a sweep a power histogram and a count of measurements
+ * above a threshold are kept.
+ *
+ * Bin n of the histogram counts measurements with power P, where
+ *
+ * bin_min + n * bin_width <= P < bin_min + (n + 1) * bin_width
+ *
+ * n = 0 .. bin_num - 1
+ *
+ * Measurements outside the histogram range are counted in the first or last
+ * bin. When a bin count would overflow, all bins for that channel are
+ * halved, so histograms keep their shape over long runs, while sweep and 
+ * threshold counters are exact. */
+struct stats_config {
+	/* Number of channels in a sweep */
+	int channel_num;
+
+	/* Lower bound of the first histogram bin in 0.01 dBm */
+	int bin_min;
+
+	/* Width of a histogram bin in 0.01 dB */
+	int bin_width;
+
+	/* Number of histogram bins */
+	int bin_num;
+
+	/* Measurements above this level (in 0.01 dBm) are counted as busy */
+	int threshold;
+};
+
+/* Histogram bounds and threshold must be within the range of measurements
+ * (short int in 0.01 dBm) */
+#define STATS_POWER_MIN		-32700
+#define STATS_POWER_MAX		32700
+
+/* Largest number of bins per channel and of bins in all channels */
+#define STATS_BIN_MAX		1000
+#define STATS_HIST_MAX		8192
+
+struct stats {
+	struct stats_config config;
+
+	/* Number of sweeps counted */
+	uint32_t sweep_num;
+
+	/* above[m] = number of measurements above threshold on channel m */
+	uint32_t* above;
+
+	/* hist[m * bin_num + n] = count in bin n for channel m */
+	uint16_t* hist;
+};
+
+int stats_init(struct stats* stats, const struct stats_config* config);
+void stats_free(struct stats* stats);
+void stats_update(struct stats* stats, const short int data_list[]);
+
+#endif